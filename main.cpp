@@ -7,6 +7,10 @@
 #include "physics/material.h"
 #include "physics/hittable_list.h"
 #include "physics/sphere.h"
+#include "physics/plane.h"
+#include "physics/instance.h"
+#include "physics/bvh_stats.h"
+#include "render/render_server.h"
 
 
 #include <time.h>
@@ -16,7 +20,12 @@ int main () {
     hittable_list world;
 
     auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+    // a huge sphere works too -- finalize() keeps oversized objects out of the bvh either way
+    // world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    // image textures are tiled + mip mapped files, converted once from a ppm
+    // convert_ppm_texture("assets/ground.ppm", "assets/ground.rtex");
+    // ground_material = make_shared<lambertian>(make_shared<image_texture>("assets/ground.rtex"));
 
     for (int a = -10; a < 10; a++) {
         for (int b = -10; b < 10; b++) {
@@ -69,6 +78,19 @@ int main () {
     // world.add(make_shared<sphere>(point3(-1.0, 0, -1.0), 0.4, material_bubble));
     // world.add(make_shared<sphere>(point3(1.0, 0, -1.0), 0.5, material_right));
 
+    // instancing -- build the object once (with its own bvh) and place transformed copies of it
+    // auto cluster = make_shared<hittable_list>();
+    // cluster->add(make_shared<sphere>(point3(0, 0.2, 0), 0.2, material2));
+    // cluster->add(make_shared<sphere>(point3(0, 0.5, 0), 0.1, material3));
+    // cluster->finalize(2);
+    // for (int i = 0; i < 8; i++) {
+    //     world.add(make_shared<instance>(cluster, transform::translate(vec3(i - 4, 0, 3)) * transform::rotate_y(45 * i)));
+    // }
+
+    // emissive lights -- add_light() registers the sphere for direct light sampling
+    // auto light_material = make_shared<diffuse_light>(color(15, 15, 15));
+    // world.add_light(make_shared<sphere>(point3(0, 6, 0), 1.0, light_material));
+
     
     // camera cam;
     camera cam;
@@ -95,14 +117,37 @@ int main () {
     cam.lookat   = point3(0,0,0);
     cam.vup      = vec3(0,1,0);
 
+    // cam.sky_background = false;       // night time -- only the emissive lights light the scene
+
+    // cam.output_aovs = true;          // first hit albedo / normal / depth images
+    // cam.denoise = true;              // low spp + denoise for previews
+    // cam.closed_world = true;         // devirtualized spheres / instances / built-in materials
+    // cam.traversal = pixel_order::scanline;    // or morton / hilbert (default) -- compare the render times
+    // cam.status_file = "assets/status.json";  // json progress for job schedulers to poll
+    // cam.hit_cache_file = "assets/hits.bin"; // closed world -- reuse camera ray hits while editing materials
+    // cam.pin_workers = true;           // + cam.numa_replicate = true on multi socket machines
+    // cam.benchmark_pinning(&world);     // prints pinned vs unpinned throughput
+    // cam.streamed_world = scene;        // out of core spheres -- see streamed_scene_builder
+    // cam.output_format = image_format::png;  // or qoi -- encoded band by band while the workers render
+    // cam.sort_secondary_rays = true;     // bounces 2+ traced in batches sorted by direction + origin
+    // cam.texture_cache_mb = 64;          // image texture tiles kept in memory per worker (lru)
+
     cam.defocus_angle = 0.8;
     cam.focus_dist    = 13.0;
 
     int bvh_depth = 9;
+    // world.lazy_bvh = true;              // bvh nodes split on first use -- big scenes start rendering right away
     world.finalize(cam.get_center(), bvh_depth);
+    // bvh_statistics::compute(world.bvh).print(std::cout);     // sah cost, depth, leaf sizes, overlap
+    // cam.heatmap = true;                  // false color nodes / primitives tested per camera ray
 
 
     cam.multi_process_render(&world, 0, cam.width);
     // cam.render(world, 0, cam.width);
+    // cam.progressive_render(&world);     // preview -- 8x8 blocks, refined + accumulated every pass
+    // cam.deadline_render(&world, 30.0);   // 30 s wall clock budget, samples_per_pixel is the cap -- noisy tiles first
+    // cam.distributed_render(&world, "tcp::7000", 4);   // coordinator + 4 local workers -- more can join from
+    // cam.render_worker(&world, "tcp:render-host:7000");  // other hosts running the same scene + camera
+    // render_server(&world, cam).serve_stdin();          // keep the scene loaded -- one job per line, see render_server
 
 }
\ No newline at end of file
@@ -0,0 +1,630 @@
+#include "utils/common.h"
+#include "utils/color.h"
+
+#include "math/sampler.h"
+#include "math/warp.h"
+#include "physics/camera.h"
+#include "physics/hittable_list.h"
+#include "physics/material.h"
+#include "physics/sphere.h"
+#include "physics/plane.h"
+#include "render/image_writer.h"
+#include "render/progress.h"
+#include "render/texture_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+
+
+// ----------------------------------------------------- //
+// regression suite
+// ----------------------------------------------------- //
+// renders a fixed set of scenes and checks them against regression/golden/<scene>.ppm (image)
+// and regression/baselines.txt (time) -- `make regression` runs it, `make regression-update`
+// re-records both after an intended change (images) or on a new machine (times)
+// the scenes are deterministic: the sphere layouts come from a hashed counter, the samples from
+// the per pixel sobol sequence, so an unchanged renderer reproduces the goldens exactly
+// a renderer that draws its samples differently (another warp, another sampler dimension order)
+// but is still correct only changes the noise. the golden images are recorded with a few other
+// sampler seeds as well, and how far those land from the golden is the scene's noise floor
+// (regression/golden/noise.txt) -- the image check allows the floor times a margin per metric
+
+static const char* golden_dir = "regression/golden/";
+static const char* noise_path = "regression/golden/noise.txt";
+static const char* baseline_path = "regression/baselines.txt";
+
+enum class sphere_mix { book, glass, metal };
+
+struct regression_scene {
+    const char* name;
+    int grid;                   // spheres on a (2 grid) x (2 grid) lattice, as in main.cpp
+    sphere_mix mix;
+    double defocus_angle;
+    int width;
+    int samples_per_pixel;
+};
+
+static const regression_scene scenes[] = {
+    {"spheres-small",   4,  sphere_mix::book,  0.8, 240, 8},
+    {"spheres-medium",  10, sphere_mix::book,  0.8, 240, 8},
+    {"spheres-large",   24, sphere_mix::book,  0.8, 240, 8},
+    {"spheres-pinhole", 10, sphere_mix::book,  0.0, 240, 8},
+    {"glass",           10, sphere_mix::glass, 0.0, 240, 8},
+    {"metal",           10, sphere_mix::metal, 0.0, 240, 8},
+};
+
+// layout numbers -- a counter through the sampler's hash, the same on every platform
+// (std::rand sequences differ between c libraries, and so would the scenes)
+class layout_random {
+private:
+    uint32_t counter = 0;
+
+public:
+    double next(double min = 0, double max = 1) {
+        return min + (max - min) * uint_to_unit(hash_combine(1, counter++));
+    }
+
+    color next_color(double min = 0, double max = 1) {
+        double r = next(min, max);
+        double g = next(min, max);
+        return color(r, g, next(min, max));
+    }
+};
+
+// the main.cpp scene -- `mix` replaces every small sphere's material
+// `repaint` gives the big metal sphere the ground's material: one material fewer, same geometry
+static void build_spheres(hittable_list& world, int grid, sphere_mix mix, bool repaint = false) {
+    layout_random rng;
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    for (int a = -grid; a < grid; a++) {
+        for (int b = -grid; b < grid; b++) {
+            auto choose_mat = rng.next();
+            double radius = rng.next() * 0.4 + 0.1;
+            double x = a + 0.9*rng.next();
+            point3 center(x, radius, b + 0.9*rng.next());
+            if ((center - point3(4, radius, 0)).length() <= 0.9) {
+                continue;
+            }
+
+            // every branch draws the same numbers, so the layout is the same for every mix
+            auto albedo = rng.next_color() * rng.next_color();
+            auto metal_albedo = rng.next_color(0.5, 1);
+            auto fuzz = rng.next(0, 0.5);
+
+            shared_ptr<material> sphere_material;
+            if (mix == sphere_mix::glass || (mix == sphere_mix::book && choose_mat >= 0.95)) {
+                sphere_material = make_shared<dielectric>(1.5);
+            } else if (mix == sphere_mix::metal || choose_mat >= 0.8) {
+                sphere_material = make_shared<metal>(metal_albedo, fuzz);
+            } else {
+                sphere_material = make_shared<lambertian>(albedo);
+            }
+            world.add(make_shared<sphere>(center, radius, sphere_material));
+        }
+    }
+
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+    shared_ptr<material> big_metal = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, repaint ? ground_material : big_metal));
+}
+
+
+// ----------------------------------------------------- //
+// image comparison
+// ----------------------------------------------------- //
+// both images as 8 bit gamma 2 -- what the renderer writes
+//     rmse  : root mean square error over every channel, in [0, 1] -- nearly the same for every
+//             seed, so a small margin catches errors about half the size of the noise
+//     block : largest mean error of any 8x8 block -- per pixel noise mostly averages out, a
+//             missing or wrongly shaded object does not
+//     mean  : largest mean error of a channel over the whole image -- a slight bias everywhere
+//             (a material a few percent too dark) that the other two lose in the noise
+
+struct image_difference {
+    double rmse = 0;
+    double block = 0;
+    double mean = 0;
+};
+
+static image_difference compare_images(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int width, int height) {
+    image_difference diff;
+    double squared = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = (int(a[i]) - int(b[i])) / 255.0;
+        squared += d * d;
+    }
+    diff.rmse = std::sqrt(squared / std::max<size_t>(1, a.size()));
+
+    double channel_sum[3] = {0, 0, 0};
+    for (size_t i = 0; i < a.size(); i++) {
+        channel_sum[i % 3] += (int(a[i]) - int(b[i])) / 255.0;
+    }
+    for (int c = 0; c < 3; c++) {
+        diff.mean = std::max(diff.mean, std::fabs(channel_sum[c]) / std::max<size_t>(1, a.size() / 3));
+    }
+
+    const int block = 8;
+    for (int by = 0; by < height; by += block) {
+        for (int bx = 0; bx < width; bx += block) {
+            double sum = 0;
+            int count = 0;
+            for (int y = by; y < std::min(height, by + block); y++) {
+                for (int x = bx; x < std::min(width, bx + block); x++) {
+                    for (int c = 0; c < 3; c++) {
+                        size_t i = (size_t(y) * width + x) * 3 + c;
+                        sum += (int(a[i]) - int(b[i])) / 255.0;
+                        count++;
+                    }
+                }
+            }
+            diff.block = std::max(diff.block, std::fabs(sum / count));
+        }
+    }
+    return diff;
+}
+
+// one line per scene: name, rmse, block, mean -- the largest differences between the golden image and
+// the same scene rendered with other sampler seeds
+static std::map<std::string, image_difference> read_noise_floors() {
+    std::map<std::string, image_difference> floors;
+    std::ifstream input(noise_path);
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string name;
+        image_difference d;
+        if (fields >> name >> d.rmse >> d.block >> d.mean) {
+            floors[name] = d;
+        }
+    }
+    return floors;
+}
+
+static bool write_noise_floors(const std::map<std::string, image_difference>& floors) {
+    std::ofstream output(noise_path);
+    if (!output.is_open()) {
+        std::cerr << "Error: noise floor file failed to open: " << noise_path << std::endl;
+        return false;
+    }
+    output << "# scene  rmse  block  mean -- largest difference of other sampler seeds from the golden image" << std::endl;
+    for (const auto& entry : floors) {
+        output << entry.first << ' ' << entry.second.rmse << ' ' << entry.second.block << ' ' << entry.second.mean << std::endl;
+    }
+    return bool(output);
+}
+
+
+// ----------------------------------------------------- //
+// timing baselines
+// ----------------------------------------------------- //
+// one line per scene: name, wall milliseconds, cpu milliseconds (all workers), rays traced per
+// second (wall -- camera, bounce + shadow rays) -- medians of the runs. the check uses cpu time
+// by default: on a shared machine the wall time moves with everything else running on it, the
+// cpu time less so
+
+struct baseline {
+    double ms;
+    double cpu_ms;
+    double rays_per_second;
+};
+
+// cpu time of every child process waited for so far
+static double children_cpu_ms() {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-3;
+}
+
+static double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static std::map<std::string, baseline> read_baselines() {
+    std::map<std::string, baseline> baselines;
+    std::ifstream input(baseline_path);
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string name;
+        baseline b;
+        if (fields >> name >> b.ms >> b.cpu_ms >> b.rays_per_second) {
+            baselines[name] = b;
+        }
+    }
+    return baselines;
+}
+
+static bool write_baselines(const std::map<std::string, baseline>& baselines) {
+    std::ofstream output(baseline_path);
+    if (!output.is_open()) {
+        std::cerr << "Error: baseline file failed to open: " << baseline_path << std::endl;
+        return false;
+    }
+    output << "# scene  wall ms  cpu ms  rays/s -- median of the runs, recorded by `make regression-update`" << std::endl;
+    for (const auto& entry : baselines) {
+        output << entry.first << ' ' << entry.second.ms << ' ' << entry.second.cpu_ms << ' ' << entry.second.rays_per_second << std::endl;
+    }
+    return bool(output);
+}
+
+
+// ----------------------------------------------------- //
+// rendering
+// ----------------------------------------------------- //
+
+struct scene_render {
+    std::vector<float> rgb;             // the framebuffer -- what --update writes
+    std::vector<uint8_t> image;         // rgb quantized, as the renderer writes it
+    int width = 0, height = 0;
+    double ms = 0, cpu_ms = 0;          // medians over the runs
+    double rays = 0;                    // traced per run
+};
+
+static void setup_camera(camera& cam, const regression_scene& scene, uint32_t seed) {
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.width = scene.width;
+    cam.samples_per_pixel = scene.samples_per_pixel;
+    cam.max_depth = 30;
+    cam.vfov = 30;
+    cam.lookfrom = point3(15, 10, 10);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+    cam.defocus_angle = scene.defocus_angle;
+    cam.focus_dist = 13.0;
+    cam.sampler_seed = seed;
+}
+
+static bool render_scene(const regression_scene& scene, uint32_t seed, int runs, scene_render& result) {
+    hittable_list world;
+    build_spheres(world, scene.grid, scene.mix);
+
+    camera cam;
+    setup_camera(cam, scene, seed);
+
+    // the renderer's own progress + bvh output would bury the report
+    std::ostringstream quiet;
+    std::streambuf* cout_buffer = std::cout.rdbuf(quiet.rdbuf());
+    std::streambuf* clog_buffer = std::clog.rdbuf(quiet.rdbuf());
+
+    world.finalize(cam.get_center(), 9);
+    cam.prepare(&world);
+    int height = cam.get_height();
+    framebuffer fb(cam.width, height, false);
+
+    // only the shared counters (never started) -- the workers count the rays they trace into them
+    progress_reporter progress(uint64_t(cam.width) * height, cam.samples_per_pixel);
+    progress_counters* counters = progress.counters();
+
+    std::vector<double> ms, cpu_ms, rays;
+    bool rendered = fb.valid() && counters != nullptr;
+    for (int run = 0; run < runs && rendered; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double cpu_start = children_cpu_ms();
+        uint64_t rays_start = counters->rays.load();
+        rendered = cam.fork_render_pass(&world, render_pass::full(cam.samples_per_pixel), counters, &fb);
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        cpu_ms.push_back(children_cpu_ms() - cpu_start);
+        rays.push_back(double(counters->rays.load() - rays_start));
+    }
+
+    std::cout.rdbuf(cout_buffer);
+    std::clog.rdbuf(clog_buffer);
+    if (!rendered) {
+        return false;
+    }
+
+    result.rgb.assign(fb.color_data(), fb.color_data() + size_t(cam.width) * height * 3);
+    quantize_rows(fb.color_data(), cam.width, 0, height, result.image);
+    result.width = cam.width;
+    result.height = height;
+    result.ms = median(ms);
+    result.cpu_ms = median(cpu_ms);
+    result.rays = median(rays);
+    return true;
+}
+
+
+// ----------------------------------------------------- //
+// batch warps
+// ----------------------------------------------------- //
+// the 4 and 8 wide warps against the scalar ones, element by element -- they have to be equal,
+// not just close (the renderer mixes both and expects the same image)
+
+template <int N>
+static int check_batch_warps(const double* u1, const double* u2, int count) {
+    int mismatches = 0;
+    for (int first = 0; first + N <= count; first += N) {
+        warp_batch<N> disk, hemisphere, sphere;
+        warp_concentric_disk<N>(u1 + first, u2 + first, disk);
+        warp_cosine_hemisphere<N>(u1 + first, u2 + first, hemisphere);
+        warp_uniform_sphere<N>(u1 + first, u2 + first, sphere);
+
+        for (int i = 0; i < N; i++) {
+            vec3 d = warp_concentric_disk(u1[first + i], u2[first + i]);
+            vec3 h = warp_cosine_hemisphere(u1[first + i], u2[first + i]);
+            vec3 s = warp_uniform_sphere(u1[first + i], u2[first + i]);
+            bool same = disk.x[i] == d.x() && disk.y[i] == d.y() && disk.z[i] == d.z()
+                     && hemisphere.x[i] == h.x() && hemisphere.y[i] == h.y() && hemisphere.z[i] == h.z()
+                     && sphere.x[i] == s.x() && sphere.y[i] == s.y() && sphere.z[i] == s.z();
+            mismatches += same ? 0 : 1;
+        }
+    }
+    return mismatches;
+}
+
+static bool check_warps(std::string& report) {
+    // the corners + centre of the unit square, then hashed points
+    std::vector<double> u1 = {0, 0, 0.5, 0.5, std::nextafter(1.0, 0.0), 0, std::nextafter(1.0, 0.0), 0.25};
+    std::vector<double> u2 = {0, 0.5, 0.5, 0, std::nextafter(1.0, 0.0), std::nextafter(1.0, 0.0), 0, 0.75};
+    layout_random rng;
+    while (u1.size() < 4096) {
+        u1.push_back(rng.next());
+        u2.push_back(rng.next());
+    }
+
+    int mismatches = check_batch_warps<4>(u1.data(), u2.data(), int(u1.size()))
+                   + check_batch_warps<8>(u1.data(), u2.data(), int(u1.size()));
+    report = std::to_string(mismatches) + " of " + std::to_string(2 * u1.size()) + " batch samples differ from the scalar warps";
+    return mismatches == 0;
+}
+
+
+// ----------------------------------------------------- //
+// hit cache
+// ----------------------------------------------------- //
+// records the camera ray hits of a scene, repaints it (one material fewer, so the materials'
+// indices move) and replays them -- the replay has to match a plain render of the repainted
+// scene exactly. a render that stops short of every sample must not leave a cache behind
+
+static const char* hit_cache_path = "build/regression-hits.bin";
+
+// one closed world render -- `cache`: record to / replay from hit_cache_path
+static bool render_closed(const regression_scene& scene, bool repaint, bool cache, const render_pass& pass,
+                          std::vector<uint8_t>& image, bool& replayed, bool& saved) {
+    hittable_list world;
+    build_spheres(world, scene.grid, scene.mix, repaint);
+
+    camera cam;
+    setup_camera(cam, scene, 0);
+    cam.closed_world = true;
+    cam.hit_cache_file = cache ? hit_cache_path : "";
+
+    std::ostringstream quiet;
+    std::streambuf* cout_buffer = std::cout.rdbuf(quiet.rdbuf());
+    std::streambuf* clog_buffer = std::clog.rdbuf(quiet.rdbuf());
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(quiet.rdbuf());
+
+    world.finalize(cam.get_center(), 9);
+    cam.prepare(&world);
+    int height = cam.get_height();
+    framebuffer fb(cam.width, height, false);
+    bool rendered = fb.valid() && cam.fork_render_pass(&world, pass, nullptr, &fb);
+    replayed = cam.replaying_hit_cache();
+    saved = rendered && cam.save_hit_cache();
+
+    std::cout.rdbuf(cout_buffer);
+    std::clog.rdbuf(clog_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+    if (rendered) {
+        quantize_rows(fb.color_data(), cam.width, 0, height, image);
+    }
+    return rendered;
+}
+
+static bool check_hit_cache(const regression_scene& scene, std::string& report) {
+    std::remove(hit_cache_path);
+    std::vector<uint8_t> image, replay, plain;
+    bool replayed = false, saved = false;
+
+    // half the samples -- nothing may be saved
+    render_pass half = render_pass::full(scene.samples_per_pixel);
+    half.sample_count /= 2;
+    if (!render_closed(scene, false, true, half, image, replayed, saved)) {
+        report = "render failed";
+        return false;
+    }
+    if (saved) {
+        report = "a render of half the samples saved its cache";
+        return false;
+    }
+
+    render_pass full = render_pass::full(scene.samples_per_pixel);
+    bool ok = render_closed(scene, false, true, full, image, replayed, saved) && saved
+           && render_closed(scene, true, true, full, replay, replayed, saved) && replayed
+           && render_closed(scene, true, false, full, plain, replayed, saved);
+    std::remove(hit_cache_path);
+    if (!ok) {
+        report = "recording or replay failed";
+        return false;
+    }
+
+    size_t different = 0;
+    for (size_t i = 0; i < plain.size(); i++) {
+        different += replay[i] != plain[i] ? 1 : 0;
+    }
+    report = std::to_string(different) + " channel values differ from a plain render after repainting";
+    return different == 0 && replay.size() == plain.size();
+}
+
+
+// ----------------------------------------------------- //
+// main
+// ----------------------------------------------------- //
+
+struct regression_options {
+    bool update = false;
+    int runs = 3;                       // timed renders per scene -- the median counts
+    int seeds = 4;                      // --update: extra sampler seeds that measure the noise floor
+    image_difference noise_margin;      // image check: allowed difference = noise floor * this, per metric
+    bool check_time = false;            // fail SLOW scenes -- off by default, timings on a shared
+                                        // machine move too much to gate the exit code on
+    double time_threshold = 0.15;       // slower than the baseline by more than this is SLOW
+    bool wall_time = false;             // check wall time instead of cpu time
+    std::string only;                   // run just this scene
+};
+
+static bool parse_options(int argc, char** argv, regression_options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--update")                              options.update = true;
+        else if (arg == "--check-time")                     options.check_time = true;
+        else if (arg == "--wall")                           options.wall_time = true;
+        else if (arg == "--runs" && has_value)              options.runs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seeds" && has_value)             options.seeds = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--time-threshold" && has_value)    options.time_threshold = std::atof(argv[++i]);
+        else if (arg == "--scene" && has_value)             options.only = argv[++i];
+        else {
+            std::cerr << "usage: regression [--update] [--runs n] [--seeds n] [--scene name]"
+                      << " [--check-time] [--wall] [--time-threshold f]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    regression_options options;
+    options.noise_margin.rmse = 1.1;
+    options.noise_margin.block = 1.5;
+    options.noise_margin.mean = 3.0;
+    if (!parse_options(argc, argv, options)) {
+        return 2;
+    }
+
+    std::map<std::string, baseline> baselines = read_baselines();
+    std::map<std::string, image_difference> noise_floors = read_noise_floors();
+    int failures = 0;
+    int slow = 0;
+
+    for (const regression_scene& scene : scenes) {
+        if (!options.only.empty() && options.only != scene.name) {
+            continue;
+        }
+
+        scene_render render;
+        if (!render_scene(scene, 0, options.runs, render)) {
+            std::cout << "FAIL  " << scene.name << ": render failed" << std::endl;
+            failures++;
+            continue;
+        }
+
+        double rays_per_second = render.rays / (render.ms / 1000);
+        std::string golden_path = std::string(golden_dir) + scene.name + ".ppm";
+
+        if (options.update) {
+            // the noise floor -- the same scene with other seeds, against the new golden
+            image_difference floor;
+            for (int seed = 1; seed <= options.seeds; seed++) {
+                scene_render other;
+                if (!render_scene(scene, uint32_t(seed), 1, other)) {
+                    std::cout << "FAIL  " << scene.name << ": render failed" << std::endl;
+                    return 1;
+                }
+                image_difference diff = compare_images(other.image, render.image, render.width, render.height);
+                floor.rmse = std::max(floor.rmse, diff.rmse);
+                floor.block = std::max(floor.block, diff.block);
+                floor.mean = std::max(floor.mean, diff.mean);
+            }
+
+            write_image(golden_path, render.rgb.data(), render.width, render.height, image_format::ppm);
+            noise_floors[scene.name] = floor;
+            baselines[scene.name] = {render.ms, render.cpu_ms, rays_per_second};
+            std::cout << "saved " << scene.name << ": noise rmse " << floor.rmse << ", block " << floor.block << ", mean " << floor.mean << " | "
+                      << render.ms << " ms, " << render.cpu_ms << " cpu ms, " << rays_per_second * 1e-6 << " M rays/s" << std::endl;
+            continue;
+        }
+
+        // image
+        std::vector<uint8_t> golden;
+        int golden_width = 0, golden_height = 0;
+        bool image_ok = false;
+        std::ostringstream report;
+        auto floor = noise_floors.find(scene.name);
+        if (!read_ppm(golden_path, golden, golden_width, golden_height)) {
+            report << "no golden image";
+        } else if (golden_width != render.width || golden_height != render.height) {
+            report << "golden image is " << golden_width << "x" << golden_height;
+        } else if (floor == noise_floors.end()) {
+            report << "no noise floor";
+        } else {
+            image_difference diff = compare_images(render.image, golden, render.width, render.height);
+            image_difference limit;
+            limit.rmse = floor->second.rmse * options.noise_margin.rmse;
+            limit.block = floor->second.block * options.noise_margin.block;
+            limit.mean = floor->second.mean * options.noise_margin.mean;
+            image_ok = diff.rmse <= limit.rmse && diff.block <= limit.block && diff.mean <= limit.mean;
+            report << "rmse " << diff.rmse << " / " << limit.rmse << ", block " << diff.block << " / " << limit.block
+                   << ", mean " << diff.mean << " / " << limit.mean;
+        }
+
+        // time -- always checked against the threshold, only fails the run with --check-time
+        bool time_ok = true;
+        auto found = baselines.find(scene.name);
+        report << " | " << render.ms << " ms, " << render.cpu_ms << " cpu ms, " << rays_per_second * 1e-6 << " M rays/s";
+        if (found == baselines.end()) {
+            report << " (no baseline)";
+        } else {
+            double measured = options.wall_time ? render.ms : render.cpu_ms;
+            double reference = options.wall_time ? found->second.ms : found->second.cpu_ms;
+            double change = measured / reference - 1;
+            time_ok = change <= options.time_threshold;
+            report << " (" << (options.wall_time ? "wall " : "cpu ") << (change >= 0 ? "+" : "") << 100 * change << "%)";
+        }
+
+        const char* status = !image_ok ? "FAIL  " : !time_ok ? "SLOW  " : "ok    ";
+        std::cout << status << scene.name << ": " << report.str() << std::endl;
+        if (!image_ok || (!time_ok && options.check_time)) {
+            failures++;
+        }
+        if (!time_ok) {
+            slow++;
+        }
+    }
+
+    // batch warps + hit cache -- exact checks, nothing to record
+    if (!options.update && (options.only.empty() || options.only == "warps")) {
+        std::string report;
+        bool ok = check_warps(report);
+        std::cout << (ok ? "ok    " : "FAIL  ") << "warps: " << report << std::endl;
+        if (!ok) {
+            failures++;
+        }
+    }
+    if (!options.update && (options.only.empty() || options.only == "hit-cache")) {
+        std::string report;
+        bool ok = check_hit_cache(scenes[0], report);
+        std::cout << (ok ? "ok    " : "FAIL  ") << "hit-cache: " << report << std::endl;
+        if (!ok) {
+            failures++;
+        }
+    }
+
+    if (options.update) {
+        return write_noise_floors(noise_floors) && write_baselines(baselines) ? 0 : 1;
+    }
+
+    if (slow > 0 && !options.check_time) {
+        std::cout << slow << " scene(s) SLOW -- more than " << 100 * options.time_threshold
+                  << "% over the baseline (not failing the run, pass --check-time for that)" << std::endl;
+    }
+    std::cout << (failures == 0 ? "all scenes passed" : std::to_string(failures) + " scene(s) failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
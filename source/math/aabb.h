@@ -20,6 +20,15 @@ public:
     vec3 size() const { return _max - _min; }
     vec3 diagonal() const { return _max - _min; }
 
+    double surface_area() const {
+        vec3 d = diagonal();
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+    double volume() const {
+        vec3 d = diagonal();
+        return d.x() * d.y() * d.z();
+    }
+
     // setters
     void set_min(const vec3& min) { _min = min; }
     void set_max(const vec3& max) { _max = max; }
@@ -31,29 +40,23 @@ public:
                (_min.z() <= other.max().z() && _max.z() >= other.min().z());
     }
 
-    // check if aabb intersects with a ray
+    // check if aabb intersects with a ray -- only the part of the ray inside ray_t counts, so a
+    // box behind the origin or beyond the closest hit found so far is skipped
     bool intersect(const ray& r, interval ray_t) const {
-        float t_min = (min().x() - r.origin().x()) / r.direction().x();
-        float t_max = (max().x() - r.origin().x()) / r.direction().x();
-
-        if (t_min > t_max) std::swap(t_min, t_max);
-
-        float ty_min = (min().y() - r.origin().y()) / r.direction().y();
-        float ty_max = (max().y() - r.origin().y()) / r.direction().y();
-
-        if (ty_min > ty_max) std::swap(ty_min, ty_max);
-
-        if ((t_min > ty_max) || (ty_min > t_max)) return false;
-
-        if (ty_min > t_min) t_min = ty_min;
-        if (ty_max < t_max) t_max = ty_max;
-
-        float tz_min = (min().z() - r.origin().z()) / r.direction().z();
-        float tz_max = (max().z() - r.origin().z()) / r.direction().z();
-
-        if (tz_min > tz_max) std::swap(tz_min, tz_max);
-
-        return !((t_min > tz_max) || (tz_min > t_max));
+        double t_min = ray_t.min;
+        double t_max = ray_t.max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            double inv_d = 1.0 / r.direction()[axis];
+            double t0 = (_min[axis] - r.origin()[axis]) * inv_d;
+            double t1 = (_max[axis] - r.origin()[axis]) * inv_d;
+            if (t0 > t1) std::swap(t0, t1);
+
+            if (t0 > t_min) t_min = t0;
+            if (t1 < t_max) t_max = t1;
+            if (t_max < t_min) return false;
+        }
+        return true;
     }
     // check if aabb contains a point
     bool contains(const vec3& point) const {
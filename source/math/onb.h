@@ -0,0 +1,49 @@
+
+#ifndef onb_h
+#define onb_h
+
+#include "utils/common.h"
+
+// ----------------------------------------------------- //
+// onb -- orthonormal basis
+// ----------------------------------------------------- //
+// used to move sampled directions from a local frame (w = "up") into world space
+
+class onb {
+private:
+    vec3 axis[3];
+
+    onb() {}
+
+public:
+    onb(const vec3& n) {
+        axis[2] = unit_vector(n);
+        vec3 a = (std::fabs(axis[2].x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        axis[1] = unit_vector(cross(axis[2], a));
+        axis[0] = cross(axis[2], axis[1]);
+    }
+
+    static onb from_unit(const vec3& n) {
+        // n must already be unit length -- no normalization, no branch (duff et al. 2017)
+        onb frame;
+        double sign = std::copysign(1.0, n.z());
+        double a = -1 / (sign + n.z());
+        double b = n.x() * n.y() * a;
+        frame.axis[0] = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+        frame.axis[1] = vec3(b, sign + n.y() * n.y() * a, -n.y());
+        frame.axis[2] = n;
+        return frame;
+    }
+
+    const vec3& u() const { return axis[0]; }
+    const vec3& v() const { return axis[1]; }
+    const vec3& w() const { return axis[2]; }
+
+    vec3 transform(const vec3& v) const {
+        // local (u, v, w) coordinates -> world space
+        return (v[0] * axis[0]) + (v[1] * axis[1]) + (v[2] * axis[2]);
+    }
+};
+
+
+#endif
@@ -0,0 +1,274 @@
+
+#ifndef sampler_h
+#define sampler_h
+
+#include "utils/common.h"
+
+#include <cstdint>
+
+
+// ----------------------------------------------------- //
+// hashing helpers
+// ----------------------------------------------------- //
+
+inline uint32_t hash_uint(uint32_t x) {
+    // lowbias32 (chris wellons) -- cheap, well mixed 32 bit hash
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return hash_uint(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+inline double uint_to_unit(uint32_t x) {
+    // [0, 1) -- 2^-32
+    return x * (1.0 / 4294967296.0);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+
+// ----------------------------------------------------- //
+// sampler
+// ----------------------------------------------------- //
+// hands out the random numbers of one camera sample, one dimension at a time
+// the camera's render kernels use the concrete (final) sampler types directly, so these calls
+// are not virtual in the render loop
+// every path asks for dimensions in the same order (pixel jitter, lens, then each bounce),
+// so a low discrepancy sampler can spread each dimension well across a pixel's samples
+
+class sampler {
+public:
+    virtual ~sampler() = default;
+
+    // call before every camera sample -- resets the dimension counter
+    virtual void start_pixel_sample(int x, int y, int sample_index) = 0;
+
+    virtual double get_1d() = 0;
+    virtual vec3 get_2d() = 0;          // (u, v, 0)
+};
+
+enum class sampler_type {
+    random,         // independent std::rand numbers -- the original behavior
+    stratified,     // jittered strata, shuffled per pixel + dimension
+    sobol,          // owen scrambled sobol, padded per dimension pair (burley 2020)
+    halton          // halton with per pixel random digit scrambling
+};
+
+
+class random_sampler final : public sampler {
+public:
+    random_sampler(int samples_per_pixel = 1, uint32_t seed = 0) {}
+
+    void start_pixel_sample(int x, int y, int sample_index) override {}
+
+    double get_1d() override {
+        return random_double();
+    }
+
+    vec3 get_2d() override {
+        return vec3(random_double(), random_double(), 0);
+    }
+};
+
+
+class stratified_sampler final : public sampler {
+private:
+    int samples_per_pixel;
+    int strata_x, strata_y;         // 2d grid -- covers at least samples_per_pixel cells
+    uint32_t seed;
+
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+    uint32_t dimension;
+
+    static uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+        // random permutation of [0, l) indexed by i (kensler, correlated multi-jittered sampling)
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p; i *= 0xe170893dU;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8; i *= 0x0929eb3fU;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1; i *= 1 | p >> 27;
+            i *= 0x6935fa69U;
+            i ^= (i & w) >> 11; i *= 0x74dcb303U;
+            i ^= (i & w) >> 2; i *= 0x9e501cc3U;
+            i ^= (i & w) >> 2; i *= 0xc860a3dfU;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+public:
+    stratified_sampler(int samples_per_pixel = 1, uint32_t seed = 0)
+        : samples_per_pixel(std::max(1, samples_per_pixel)), seed(seed), pixel_seed(0), sample_index(0), dimension(0) {
+        strata_x = std::max(1, int(std::sqrt(double(this->samples_per_pixel))));
+        strata_y = (this->samples_per_pixel + strata_x - 1) / strata_x;
+    }
+
+    void start_pixel_sample(int x, int y, int index) override {
+        pixel_seed = hash_combine(hash_combine(seed, uint32_t(x)), uint32_t(y));
+        sample_index = uint32_t(index);
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+        uint32_t stratum = permute(sample_index % samples_per_pixel, samples_per_pixel, dim_seed);
+        double jitter = uint_to_unit(hash_combine(dim_seed, sample_index));
+        return (stratum + jitter) / samples_per_pixel;
+    }
+
+    vec3 get_2d() override {
+        uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+        uint32_t cells = uint32_t(strata_x * strata_y);
+        uint32_t cell = permute(sample_index % cells, cells, dim_seed);
+        double jitter_x = uint_to_unit(hash_combine(dim_seed, sample_index * 2));
+        double jitter_y = uint_to_unit(hash_combine(dim_seed, sample_index * 2 + 1));
+        return vec3((cell % strata_x + jitter_x) / strata_x, (cell / strata_x + jitter_y) / strata_y, 0);
+    }
+};
+
+
+class sobol_sampler final : public sampler {
+private:
+    uint32_t seed;
+
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+    uint32_t dimension;
+
+    static uint32_t sobol(uint32_t index, int dim) {
+        // first two sobol dimensions -- dim 0 is van der corput, dim 1 uses v_i = v_{i-1} ^ (v_{i-1} >> 1)
+        if (dim == 0) {
+            return reverse_bits(index);
+        }
+        uint32_t result = 0;
+        uint32_t v = 1U << 31;
+        for (; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1) result ^= v;
+        }
+        return result;
+    }
+
+    static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+        x += seed;
+        x ^= x * 0x6c50b47cU;
+        x ^= x * 0xb82f1e52U;
+        x ^= x * 0xc7afe638U;
+        x ^= x * 0x8d22f6e6U;
+        return x;
+    }
+
+    static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+        // owen scrambling -- every bit is flipped depending on the bits above it
+        x = reverse_bits(x);
+        x = laine_karras_permutation(x, seed);
+        return reverse_bits(x);
+    }
+
+public:
+    sobol_sampler(int samples_per_pixel = 1, uint32_t seed = 0) : seed(seed), pixel_seed(0), sample_index(0), dimension(0) {}
+
+    void start_pixel_sample(int x, int y, int index) override {
+        pixel_seed = hash_combine(hash_combine(seed, uint32_t(x)), uint32_t(y));
+        sample_index = uint32_t(index);
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+        uint32_t index = nested_uniform_scramble(sample_index, dim_seed);
+        return uint_to_unit(nested_uniform_scramble(sobol(index, 0), hash_uint(dim_seed)));
+    }
+
+    vec3 get_2d() override {
+        // every pair of dimensions uses sobol (0, 1) with its own index shuffle + scramble
+        uint32_t dim_seed = hash_combine(pixel_seed, dimension++);
+        uint32_t index = nested_uniform_scramble(sample_index, dim_seed);
+        uint32_t x = nested_uniform_scramble(sobol(index, 0), hash_combine(dim_seed, 0));
+        uint32_t y = nested_uniform_scramble(sobol(index, 1), hash_combine(dim_seed, 1));
+        return vec3(uint_to_unit(x), uint_to_unit(y), 0);
+    }
+};
+
+
+class halton_sampler final : public sampler {
+private:
+    uint32_t seed;
+
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+    uint32_t dimension;
+
+    static int prime(uint32_t dimension) {
+        static const int primes[32] = {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+            59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+        };
+        // past the table the bases repeat -- the per dimension scramble keeps them decorrelated
+        return primes[dimension % 32];
+    }
+
+    static double scrambled_radical_inverse(int base, uint32_t index, uint32_t scramble_seed) {
+        // radical inverse with a random shift of every digit (random digit scrambling)
+        // trailing zero digits get shifted too, so keep going until the digits stop mattering
+        double inv_base = 1.0 / base;
+        double inv_base_n = inv_base;
+        double result = 0.0;
+        for (uint32_t position = 0; inv_base_n > 1e-10; position++) {
+            uint32_t digit = index % base;
+            uint32_t shift = hash_combine(scramble_seed, position) % base;
+            result += ((digit + shift) % base) * inv_base_n;
+            index /= base;
+            inv_base_n *= inv_base;
+        }
+        return std::min(result, 0.99999999999999989);
+    }
+
+    double next() {
+        uint32_t dim = dimension++;
+        return scrambled_radical_inverse(prime(dim), sample_index, hash_combine(pixel_seed, dim));
+    }
+
+public:
+    halton_sampler(int samples_per_pixel = 1, uint32_t seed = 0) : seed(seed), pixel_seed(0), sample_index(0), dimension(0) {}
+
+    void start_pixel_sample(int x, int y, int index) override {
+        pixel_seed = hash_combine(hash_combine(seed, uint32_t(x)), uint32_t(y));
+        sample_index = uint32_t(index);
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        return next();
+    }
+
+    vec3 get_2d() override {
+        double u = next();
+        double v = next();
+        return vec3(u, v, 0);
+    }
+};
+
+
+#endif
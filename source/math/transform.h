@@ -0,0 +1,163 @@
+
+#ifndef transform_h
+#define transform_h
+
+#include "utils/common.h"
+
+// ----------------------------------------------------- //
+// transform
+// ----------------------------------------------------- //
+// affine 3x4 matrix -- the bottom row is implicitly (0, 0, 0, 1)
+
+class transform {
+public:
+    double m[3][4];
+
+    transform() {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                m[i][j] = (i == j) ? 1.0 : 0.0;
+            }
+        }
+    }
+
+    // ----------------------------------------------------- //
+    // logic
+    // ----------------------------------------------------- //
+
+    point3 apply_point(const point3& p) const {
+        return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        // vectors ignore the translation column
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const {
+        // multiply by the transpose of the linear part
+        // NOTE: normals are transformed by the inverse transpose, so call this on the inverse
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    aabb apply(const aabb& box) const {
+        // transform all 8 corners and take the bounds of the result
+        vec3 min(1e9, 1e9, 1e9);
+        vec3 max(-1e9, -1e9, -1e9);
+
+        for (int i = 0; i < 8; i++) {
+            point3 corner((i & 1) ? box.max().x() : box.min().x(),
+                          (i & 2) ? box.max().y() : box.min().y(),
+                          (i & 4) ? box.max().z() : box.min().z());
+            point3 p = apply_point(corner);
+            min = vec3::min(min, p);
+            max = vec3::max(max, p);
+        }
+
+        return aabb(min, max);
+    }
+
+    transform inverse() const {
+        // invert linear part with the adjugate, then solve for the translation
+        const double a = m[0][0], b = m[0][1], c = m[0][2];
+        const double d = m[1][0], e = m[1][1], f = m[1][2];
+        const double g = m[2][0], h = m[2][1], k = m[2][2];
+
+        double det = a * (e * k - f * h) - b * (d * k - f * g) + c * (d * h - e * g);
+        if (std::fabs(det) < 1e-12) {
+            std::cerr << "Error: transform is not invertible" << std::endl;
+            return transform();
+        }
+        double inv_det = 1.0 / det;
+
+        transform result;
+        result.m[0][0] =  (e * k - f * h) * inv_det;
+        result.m[0][1] = -(b * k - c * h) * inv_det;
+        result.m[0][2] =  (b * f - c * e) * inv_det;
+        result.m[1][0] = -(d * k - f * g) * inv_det;
+        result.m[1][1] =  (a * k - c * g) * inv_det;
+        result.m[1][2] = -(a * f - c * d) * inv_det;
+        result.m[2][0] =  (d * h - e * g) * inv_det;
+        result.m[2][1] = -(a * h - b * g) * inv_det;
+        result.m[2][2] =  (a * e - b * d) * inv_det;
+
+        vec3 t = result.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        result.m[0][3] = -t.x();
+        result.m[1][3] = -t.y();
+        result.m[2][3] = -t.z();
+        return result;
+    }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+
+    static transform translate(const vec3& offset) {
+        transform result;
+        result.m[0][3] = offset.x();
+        result.m[1][3] = offset.y();
+        result.m[2][3] = offset.z();
+        return result;
+    }
+
+    static transform scale(const vec3& factor) {
+        transform result;
+        result.m[0][0] = factor.x();
+        result.m[1][1] = factor.y();
+        result.m[2][2] = factor.z();
+        return result;
+    }
+
+    static transform scale(double factor) {
+        return scale(vec3(factor, factor, factor));
+    }
+
+    static transform rotate(const vec3& axis, double degrees) {
+        // rodrigues rotation around an arbitrary axis
+        vec3 n = unit_vector(axis);
+        double theta = degrees_to_radians(degrees);
+        double s = std::sin(theta);
+        double c = std::cos(theta);
+        double t = 1.0 - c;
+
+        transform result;
+        result.m[0][0] = t * n.x() * n.x() + c;
+        result.m[0][1] = t * n.x() * n.y() - s * n.z();
+        result.m[0][2] = t * n.x() * n.z() + s * n.y();
+        result.m[1][0] = t * n.x() * n.y() + s * n.z();
+        result.m[1][1] = t * n.y() * n.y() + c;
+        result.m[1][2] = t * n.y() * n.z() - s * n.x();
+        result.m[2][0] = t * n.x() * n.z() - s * n.y();
+        result.m[2][1] = t * n.y() * n.z() + s * n.x();
+        result.m[2][2] = t * n.z() * n.z() + c;
+        return result;
+    }
+
+    static transform rotate_y(double degrees) {
+        return rotate(vec3(0, 1, 0), degrees);
+    }
+};
+
+// composition -- (a * b) applies b first, then a
+inline transform operator*(const transform& a, const transform& b) {
+    transform result;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = (j == 3) ? a.m[i][3] : 0.0;
+            for (int k = 0; k < 3; k++) {
+                sum += a.m[i][k] * b.m[k][j];
+            }
+            result.m[i][j] = sum;
+        }
+    }
+    return result;
+}
+
+
+#endif
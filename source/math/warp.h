@@ -0,0 +1,133 @@
+#ifndef warp_h
+#define warp_h
+
+#include "utils/common.h"
+
+
+// ----------------------------------------------------- //
+// sample warping
+// ----------------------------------------------------- //
+// closed form maps from 2 uniform numbers in [0, 1) to points on the shapes the renderer
+// samples -- fixed cost per sample (no rejection loops), no branches (selects only) and no libm
+// calls besides sqrt, so the batch versions below are plain loops the compiler can vectorize
+// everything starts from the concentric disk map (shirley + chiu), which keeps the sampler's
+// stratification intact:
+//     concentric disk    : uniform over the unit disk
+//     cosine hemisphere  : the disk lifted onto the hemisphere around +z (pdf cos / pi)
+//     uniform sphere     : the disk lifted onto either hemisphere, equal area (pdf 1 / 4 pi)
+//     uniform cone       : the disk lifted onto the cap around +z, equal area (pdf 1 / solid angle)
+
+// sin + cos for |x| <= pi / 4 -- taylor series, error below 1e-11 over the range
+inline void sincos_quarter(double x, double& s, double& c) {
+    double x2 = x * x;
+    s = x * (1 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 + x2 * (1.0 / 362880 + x2 * (-1.0 / 39916800))))));
+    c = 1 + x2 * (-1.0 / 2 + x2 * (1.0 / 24 + x2 * (-1.0 / 720 + x2 * (1.0 / 40320 + x2 * (-1.0 / 3628800 + x2 * (1.0 / 479001600))))));
+}
+
+inline void warp_concentric_disk(double u1, double u2, double& x, double& y) {
+    double a = 2 * u1 - 1;
+    double b = 2 * u2 - 1;
+
+    // the larger coordinate is the radius, the ratio of the two the angle inside its quadrant
+    bool a_major = std::fabs(a) > std::fabs(b);
+    double r = a_major ? a : b;
+    double ratio = (a_major ? b : a) / (r != 0 ? r : 1);
+
+    double s, c;
+    sincos_quarter((pi / 4) * ratio, s, c);
+    x = r * (a_major ? c : s);
+    y = r * (a_major ? s : c);
+}
+
+inline vec3 warp_concentric_disk(double u1, double u2) {
+    double x, y;
+    warp_concentric_disk(u1, u2, x, y);
+    return vec3(x, y, 0);
+}
+
+inline vec3 warp_cosine_hemisphere(double u1, double u2) {
+    double x, y;
+    warp_concentric_disk(u1, u2, x, y);
+    return vec3(x, y, std::sqrt(std::fmax(0.0, 1 - x * x - y * y)));
+}
+
+inline void warp_uniform_sphere(double u1, double u2, double& x, double& y, double& z) {
+    // u1 < 0.5 picks the upper hemisphere -- then a disk point at radius r goes to height
+    // 1 - r^2, scaled out by sqrt(2 - r^2) (lambert's equal area projection)
+    bool upper = u1 < 0.5;
+    double dx, dy;
+    warp_concentric_disk(upper ? 2 * u1 : 2 * u1 - 1, u2, dx, dy);
+
+    double r2 = dx * dx + dy * dy;
+    double scale = std::sqrt(std::fmax(0.0, 2 - r2));
+    x = dx * scale;
+    y = dy * scale;
+    z = upper ? 1 - r2 : r2 - 1;
+}
+
+inline vec3 warp_uniform_sphere(double u1, double u2) {
+    double x, y, z;
+    warp_uniform_sphere(u1, u2, x, y, z);
+    return vec3(x, y, z);
+}
+
+inline vec3 warp_uniform_cone(double u1, double u2, double cos_theta_max) {
+    // the same lift as the sphere's, squeezed onto a cap of height 1 - cos_theta_max
+    double x, y;
+    warp_concentric_disk(u1, u2, x, y);
+
+    double height = 1 - cos_theta_max;
+    double r2 = x * x + y * y;
+    double scale = std::sqrt(std::fmax(0.0, height * (2 - r2 * height)));
+    return vec3(x * scale, y * scale, 1 - r2 * height);
+}
+
+inline double cosine_hemisphere_pdf(double cos_theta) {
+    return cos_theta < 0 ? 0 : cos_theta / pi;
+}
+
+inline double uniform_sphere_pdf() {
+    return 1 / (4 * pi);
+}
+
+
+// ----------------------------------------------------- //
+// batch warps
+// ----------------------------------------------------- //
+// N samples per call, structure of arrays in + out -- the loop bodies are the scalar maps above,
+// so every element is exactly what the scalar call returns (camera::get_rays warps a group of
+// lens samples at once)
+
+template <int N>
+struct warp_batch {
+    double x[N], y[N], z[N];
+};
+
+typedef warp_batch<4> warp_batch4;
+typedef warp_batch<8> warp_batch8;
+
+template <int N>
+inline void warp_concentric_disk(const double* u1, const double* u2, warp_batch<N>& out) {
+    for (int i = 0; i < N; i++) {
+        warp_concentric_disk(u1[i], u2[i], out.x[i], out.y[i]);
+        out.z[i] = 0;
+    }
+}
+
+template <int N>
+inline void warp_cosine_hemisphere(const double* u1, const double* u2, warp_batch<N>& out) {
+    for (int i = 0; i < N; i++) {
+        warp_concentric_disk(u1[i], u2[i], out.x[i], out.y[i]);
+        out.z[i] = std::sqrt(std::fmax(0.0, 1 - out.x[i] * out.x[i] - out.y[i] * out.y[i]));
+    }
+}
+
+template <int N>
+inline void warp_uniform_sphere(const double* u1, const double* u2, warp_batch<N>& out) {
+    for (int i = 0; i < N; i++) {
+        warp_uniform_sphere(u1[i], u2[i], out.x[i], out.y[i], out.z[i]);
+    }
+}
+
+
+#endif
@@ -19,13 +19,14 @@ private:
     
     aabb _world_bounding_box;
     int _max_depth;
+    bool _lazy;             // nodes split on the first ray that reaches them -- see bvh_node::expand
 
 public:
     // map of registered items
 
-    bvh_container(): _root(nullptr), _max_depth(0) {};
-    bvh_container(const shared_ptr<std::vector<shared_ptr<hittable>>> objects, int max_depth, point3 camera_pos)
-        : _root(nullptr), _max_depth(max_depth) {
+    bvh_container(): _root(nullptr), _max_depth(0), _lazy(false) {};
+    bvh_container(const shared_ptr<std::vector<shared_ptr<hittable>>> objects, int max_depth, point3 camera_pos, bool lazy = false)
+        : _root(nullptr), _max_depth(max_depth), _lazy(lazy) {
         
         rebuild(objects, camera_pos);
     }
@@ -48,20 +49,24 @@ public:
         }
 
         // create the root node
-        bvh_node _temp_root(_world_bounding_box, objects, 0, _max_depth, camera_pos);
-        _root = make_shared<bvh_node>(_temp_root);
+        _root = make_shared<bvh_node>(_world_bounding_box, objects, 0, _max_depth, camera_pos, _lazy);
     }
 
     std::vector<shared_ptr<bvh_node>> get_intersecting_nodes(const ray& r, interval ray_t, hit_record& rec) const {
         return _root->get_intersecting_nodes(r, ray_t, rec);;
     }
 
+    bool occluded(const ray& r, interval ray_t) const {
+        return _root->any_object_hit(r, ray_t);
+    }
+
     // ----------------------------------------------------- //
     // getters
     // ----------------------------------------------------- //
 
     shared_ptr<bvh_node> get_root() const { return _root; }
     int max_depth() const { return _max_depth; }
+    bool is_lazy() const { return _lazy; }
 
     // ----------------------------------------------------- //
     // setters
@@ -5,16 +5,31 @@
 #include "utils/common.h"
 #include "physics/hittable.h"
 
+#include <atomic>
+#include <mutex>
+
 // ----------------------------------------------------- //
 // bvh_node
 // ----------------------------------------------------- //
+// lazy nodes (see hittable_list::lazy_bvh) keep their objects unsplit until the first ray
+// reaches them -- expand() splits them exactly once, whichever thread gets there first
+// (std::call_once), so the build only pays for the parts of the scene rays actually visit
 
 class bvh_node : public hittable {
 private:
+    struct lazy_split {
+        std::once_flag once;
+        std::atomic<bool> done;
+        int max_depth;
+        point3 camera_pos;
+
+        lazy_split(int max_depth, point3 camera_pos) : done(false), max_depth(max_depth), camera_pos(camera_pos) {}
+    };
 
     shared_ptr<std::vector<shared_ptr<hittable>>> _relevant_objects;
 
-    std::vector<shared_ptr<bvh_node>> _children;
+    mutable std::vector<shared_ptr<bvh_node>> _children;    // filled by expand() for lazy nodes
+    shared_ptr<lazy_split> _pending;                        // null for nodes built eagerly
     aabb _detection_box;
     int _depth;
     bool is_leaf;
@@ -26,7 +41,7 @@ public:
     bvh_node(): is_leaf(false), _depth(0), _distance_to_camera(0.0) {
         calculate_bounding_box();
     }
-    bvh_node(const aabb detection_box, const shared_ptr<std::vector<shared_ptr<hittable>>> objects, int depth, int max_depth, point3 camera_pos): 
+    bvh_node(const aabb detection_box, const shared_ptr<std::vector<shared_ptr<hittable>>> objects, int depth, int max_depth, point3 camera_pos, bool lazy = false): 
         is_leaf(depth == max_depth), _depth(depth), _detection_box(detection_box), _relevant_objects(objects) {
 
         // set the distance to camera
@@ -43,14 +58,40 @@ public:
             // TODO - don't create child nodes -> can skip the rest of the code
             // output # of relevant objects
             // std::cout << "Leaf node at depth: " << depth << " / " << max_depth << " with " << _relevant_objects->size() << " relevant objects." << std::endl;
-            std::cout << "Bounding box: " << bounding_box << std::endl;
+            // tree shape + quality -- see bvh_statistics
             return;
         }
-        
-        // ------------------------------------------------------- //
-        // only leaf type nodes run following code
-        // create children -- 2 children -- split longest axis in half
 
+        if (lazy) {
+            // split on the first visit -- see expand
+            _pending = make_shared<lazy_split>(max_depth, camera_pos);
+            return;
+        }
+        split(max_depth, camera_pos, false);
+    }
+    ~bvh_node() {
+        _children.clear();
+    }
+
+    // ----------------------------------------------------- //
+    // logic
+    // ----------------------------------------------------- //
+
+    // builds the children of a lazy node if no one did yet -- safe to call from any thread,
+    // every caller returns with the children in place
+    void expand() const {
+        if (_pending == nullptr || _pending->done.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::call_once(_pending->once, [this]() {
+            split(_pending->max_depth, _pending->camera_pos, true);
+            _pending->done.store(true, std::memory_order_release);
+        });
+    }
+
+private:
+    // create children -- 2 children -- split longest axis in half
+    void split(int max_depth, point3 camera_pos, bool lazy) const {
         // find longest axis
         vec3 size = _detection_box.size();
         int axis = 0;
@@ -103,23 +144,17 @@ public:
             }
         }
 
-        // create children
-        bvh_node* child1 = new bvh_node(child1_box, make_shared<std::vector<shared_ptr<hittable>>>(_child_objects1), depth + 1, max_depth, camera_pos);
-        bvh_node* child2 = new bvh_node(child2_box, make_shared<std::vector<shared_ptr<hittable>>>(_child_objects2), depth + 1, max_depth, camera_pos);
+        // create children -- the children of a lazy node are lazy too
+        bvh_node* child1 = new bvh_node(child1_box, make_shared<std::vector<shared_ptr<hittable>>>(_child_objects1), _depth + 1, max_depth, camera_pos, lazy);
+        bvh_node* child2 = new bvh_node(child2_box, make_shared<std::vector<shared_ptr<hittable>>>(_child_objects2), _depth + 1, max_depth, camera_pos, lazy);
 
         // add children to vector
         _children.push_back(shared_ptr<bvh_node>(child1));
         _children.push_back(shared_ptr<bvh_node>(child2));
 
     }
-    ~bvh_node() {
-        _children.clear();
-    }
-
-    // ----------------------------------------------------- //
-    // logic
-    // ----------------------------------------------------- //
 
+public:
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // TODO : implement this function
         return bounding_box.intersect(r, ray_t);
@@ -150,7 +185,9 @@ public:
     std::vector<shared_ptr<bvh_node>> get_intersecting_nodes(const ray& r, interval ray_t, hit_record& rec) const {
         std::vector<shared_ptr<bvh_node>> result;
 
+        expand();
         for (shared_ptr<bvh_node> child : _children) {
+            TRAVERSAL_COUNTERS.nodes++;
             if (!child->hit(r, ray_t, rec)) {
                 // skip if no hit
                 continue;
@@ -173,12 +210,46 @@ public:
         
     }
 
+    bool any_object_hit(const ray& r, interval ray_t) const {
+        // same visiting rules as get_intersecting_nodes, but returns at the first object hit
+        // instead of collecting every leaf -- for occlusion queries
+        if (is_leaf) {
+            return any_hit(*_relevant_objects, r, ray_t);
+        }
+
+        expand();
+        hit_record rec;
+        for (const shared_ptr<bvh_node>& child : _children) {
+            TRAVERSAL_COUNTERS.nodes++;
+            if (!child->hit(r, ray_t, rec)) {
+                continue;
+            }
+            if (child->is_leaf_node() ? any_hit(*child->get_relevant_objects(), r, ray_t) : child->any_object_hit(r, ray_t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool any_hit(const std::vector<shared_ptr<hittable>>& objects, const ray& r, interval ray_t) {
+        for (const shared_ptr<hittable>& object : objects) {
+            TRAVERSAL_COUNTERS.primitives++;
+            if (object->occluded(r, ray_t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     // ----------------------------------------------------- //
     // getters
     // ----------------------------------------------------- //
     aabb get_bounding_box() const { return _detection_box; }
     shared_ptr<std::vector<shared_ptr<hittable>>> get_relevant_objects() const { return _relevant_objects; }
+    // empty for lazy nodes no ray reached yet (is_pending) -- call expand() first to build them
+    const std::vector<shared_ptr<bvh_node>>& get_children() const { return _children; }
     bool is_leaf_node() const { return is_leaf; }
+    bool is_pending() const { return _pending != nullptr && !_pending->done.load(std::memory_order_acquire); }
 };
 
 
@@ -0,0 +1,129 @@
+
+#ifndef bvh_stats_h
+#define bvh_stats_h
+
+#include "utils/common.h"
+
+#include "physics/bvh_container.h"
+
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+
+// ----------------------------------------------------- //
+// bvh_statistics
+// ----------------------------------------------------- //
+// shape + quality of a built bvh_container -- for checking builder changes
+//     bvh_statistics::compute(world.bvh).print(std::cout);
+// sah cost is the expected cost of one random ray through the tree, relative to testing one
+// primitive: every node is weighted by the chance a ray that hits the root also hits it
+// (surface area ratio). overlap is the volume shared by sibling boxes -- rays in it visit both
+// lazy trees are measured as they are -- nodes no ray reached yet count as (pending) leaves
+
+struct bvh_statistics {
+    int node_count = 0;
+    int interior_count = 0;
+    int leaf_count = 0;
+    int empty_leaf_count = 0;
+    int pending_count = 0;                  // lazy nodes not split yet -- included in leaf_count
+    int max_depth = 0;
+    size_t primitive_references = 0;        // sum of leaf sizes
+    size_t largest_leaf = 0;
+
+    double sah_cost = 0;
+    double overlap_volume = 0;              // summed over every pair of siblings
+    double child_volume = 0;                // summed over every child -- overlap_volume is relative to this
+
+    std::map<size_t, int> leaf_histogram;   // leaf size bucket (0, 1, 2, 4, 8 ... -- upper bound) -> leaf count
+
+    static bvh_statistics compute(const bvh_container& bvh, double traversal_cost = 1.0, double intersection_cost = 1.0) {
+        bvh_statistics stats;
+        shared_ptr<bvh_node> root = bvh.get_root();
+        if (root == nullptr) {
+            return stats;
+        }
+
+        double root_area = root->bounding_box.surface_area();
+        stats.visit(*root, 0, root_area > 0 ? 1.0 / root_area : 0.0, traversal_cost, intersection_cost);
+        return stats;
+    }
+
+    void print(std::ostream& out) const {
+        out << "BVH: " << node_count << " nodes (" << interior_count << " interior, " << leaf_count << " leaves, "
+            << empty_leaf_count << " empty, " << pending_count << " pending), depth " << max_depth << std::endl;
+        out << "BVH: sah cost " << sah_cost << ", " << primitive_references << " primitive references, largest leaf "
+            << largest_leaf << std::endl;
+        out << "BVH: sibling overlap " << overlap_volume << " ("
+            << (child_volume > 0 ? 100.0 * overlap_volume / child_volume : 0.0) << "% of child volume)" << std::endl;
+
+        out << "BVH: leaf sizes" << std::endl;
+        size_t lower = 0;
+        for (const auto& bucket : leaf_histogram) {
+            std::ostringstream range;
+            range << lower;
+            if (bucket.first != lower) range << "-" << bucket.first;
+            out << "    " << std::setw(9) << range.str() << " : " << bucket.second << std::endl;
+            lower = bucket.first + 1;
+        }
+    }
+
+private:
+    static size_t bucket_of(size_t size) {
+        size_t bucket = 0;
+        while (bucket < size) bucket = bucket == 0 ? 1 : bucket * 2;
+        return bucket;
+    }
+
+    void visit(const bvh_node& node, int depth, double inverse_root_area, double traversal_cost, double intersection_cost) {
+        node_count++;
+        max_depth = std::max(max_depth, depth);
+
+        // empty nodes keep a zero box -- no area, no cost
+        size_t count = node.get_relevant_objects() != nullptr ? node.get_relevant_objects()->size() : 0;
+        double probability = count > 0 ? node.bounding_box.surface_area() * inverse_root_area : 0.0;
+
+        const std::vector<shared_ptr<bvh_node>>& children = node.get_children();
+        if (node.is_leaf_node() || children.empty()) {
+            leaf_count++;
+            empty_leaf_count += count == 0 ? 1 : 0;
+            pending_count += node.is_pending() ? 1 : 0;
+            primitive_references += count;
+            largest_leaf = std::max(largest_leaf, count);
+            leaf_histogram[bucket_of(count)]++;
+            sah_cost += probability * count * intersection_cost;
+            return;
+        }
+
+        interior_count++;
+        sah_cost += probability * traversal_cost;
+
+        for (size_t i = 0; i < children.size(); i++) {
+            if (!children[i]->get_relevant_objects()->empty()) {
+                child_volume += children[i]->bounding_box.volume();
+            }
+            for (size_t j = i + 1; j < children.size(); j++) {
+                overlap_volume += shared_volume(*children[i], *children[j]);
+            }
+            visit(*children[i], depth + 1, inverse_root_area, traversal_cost, intersection_cost);
+        }
+    }
+
+    static double shared_volume(const bvh_node& a, const bvh_node& b) {
+        if (a.get_relevant_objects()->empty() || b.get_relevant_objects()->empty()) {
+            return 0;
+        }
+
+        double volume = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            double low = std::max(a.bounding_box.min()[axis], b.bounding_box.min()[axis]);
+            double high = std::min(a.bounding_box.max()[axis], b.bounding_box.max()[axis]);
+            if (high <= low) return 0;
+            volume *= high - low;
+        }
+        return volume;
+    }
+};
+
+
+#endif
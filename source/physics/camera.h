@@ -7,6 +7,24 @@
 #include "hittable_list.h"
 #include "material.h"
 
+#include "math/sampler.h"
+
+#include "physics/scene_view.h"
+#include "physics/closed_scene.h"
+#include "physics/streamed_scene.h"
+
+#include "render/framebuffer.h"
+#include "render/denoiser.h"
+#include "render/traversal.h"
+#include "render/progress.h"
+#include "render/progressive.h"
+#include "render/hit_cache.h"
+#include "render/topology.h"
+#include "render/distributed.h"
+#include "render/image_writer.h"
+#include "render/ray_sort.h"
+#include "render/deadline.h"
+
 #include <atomic>
 #include <thread>
 #include <vector>
@@ -19,6 +37,7 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <cstring>
 
 
 class camera {
@@ -29,10 +48,21 @@ private:
     point3 pixel00_loc;             // Location of pixel 0, 
     vec3 pixel_delta_u;             // Offset to pixel to the right
     vec3 pixel_delta_v;             // Offset to pixel below
+    double pixel_spread;            // Angle one pixel spans -- the spread of the camera's ray cones
     double pixel_samples_scale;     // Color scale factor for a sum of pixel samples -- anti-aliasing
     vec3 u, v, w;                   // Camera frame basis vectors
     vec3 defocus_disk_u;            // Defocus disk horizontal radius
     vec3 defocus_disk_v;            // Defocus disk vertical radius
+    shared_ptr<closed_scene> compiled_scene;    // set by prepare_scene in closed world mode
+    shared_ptr<hit_cache> primary_hits;         // set by prepare_scene if hit_cache_file is set
+    bool replay_primary_hits = false;           // primary_hits was loaded -- otherwise it records
+    cpu_topology topology;                      // set by prepare_scene if workers are pinned
+    band_tracker* output_bands = nullptr;       // set while the beauty image is encoded during the render
+    void (camera::*render_tile_kernel)(const hittable_list*, const area2d&, const std::vector<pixel_coord>&, const render_pass&, framebuffer*) const;    // set by prepare_scene
+
+    // worker processes per render
+    // int render_process_count = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    static const int render_process_count = 7;
 
     void initialize() {
         height = int(width / aspect_ratio);
@@ -60,6 +90,7 @@ private:
         // calculate horizontal + vertical delta vectors from pixel to pixel
         pixel_delta_u = viewport_u / width;
         pixel_delta_v = viewport_v / height;
+        pixel_spread = pixel_delta_u.length() / focus_dist;
 
         // calculate location of upper left pixel (0th pixel)
         auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
@@ -72,59 +103,253 @@ private:
 
     }
 
-    ray get_ray(int i, int j) const {
+    template <bool depth_of_field, class sampler_t>
+    ray get_ray(int i, int j, sampler_t& smp) const {
         // Constructs a camera ray originating from the origin and directed at randomly sampled
         // point around the pixel location i, j
 
-        auto offset = sample_square();
+        auto offset = sample_square(smp);
         auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
         // camera with adjustable depth of field // focus range
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        auto ray_origin = depth_of_field ? defocus_disk_sample(smp) : center;
         auto ray_direction = pixel_sample - ray_origin;
 
         return ray(ray_origin, ray_direction);
     }
 
-    vec3 sample_square() const {
+    template <bool depth_of_field, int N, class sampler_t>
+    void get_rays(int i, int j, int first_sample, int count, sampler_t* smp, ray* rays) const {
+        // get_ray for `count` (<= N) consecutive samples of pixel i, j -- smp[k] is started on
+        // sample first_sample + k and left after the camera dimensions, as get_ray leaves it
+        // the lens points of the group go through one batch warp
+        vec3 offset[N];
+        double u1[N], u2[N];
+        for (int k = 0; k < N; k++) {
+            u1[k] = u2[k] = 0.5;
+            if (k >= count) {
+                continue;
+            }
+            smp[k].start_pixel_sample(i, j, first_sample + k);
+            offset[k] = sample_square(smp[k]);
+            if (depth_of_field) {
+                vec3 u = smp[k].get_2d();
+                u1[k] = u.x();
+                u2[k] = u.y();
+            }
+        }
+
+        warp_batch<N> lens;
+        if (depth_of_field) {
+            warp_concentric_disk<N>(u1, u2, lens);
+        }
+
+        for (int k = 0; k < count; k++) {
+            auto pixel_sample = pixel00_loc + ((i + offset[k].x()) * pixel_delta_u) + ((j + offset[k].y()) * pixel_delta_v);
+            auto ray_origin = depth_of_field ? center + (lens.x[k] * defocus_disk_u) + (lens.y[k] * defocus_disk_v) : center;
+            rays[k] = ray(ray_origin, pixel_sample - ray_origin);
+        }
+    }
+
+    template <class sampler_t>
+    vec3 sample_square(sampler_t& smp) const {
         // Returns the vector to a random point in teh [+-.5, +-.5] unit square range
-        return vec3(random_double() - 0.5, random_double() + 0.5, 0);
+        vec3 u = smp.get_2d();
+        return vec3(u.x() - 0.5, u.y() - 0.5, 0);
     }
 
-    point3 defocus_disk_sample() const {
+    template <class sampler_t>
+    point3 defocus_disk_sample(sampler_t& smp) const {
         // returns a random point inside of camera defocus disk
-        auto p = random_in_unit_disk();
+        vec3 u = smp.get_2d();
+        auto p = warp_concentric_disk(u.x(), u.y());
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable_list* world) const {
-        if (depth <= 0) {
-            return color(0, 0, 0);
+    template <class sampler_t>
+    static vec3 get_3d(sampler_t& smp) {
+        // 2d + 1d sample packed together -- the per bounce inputs of scatter / light sampling
+        vec3 u = smp.get_2d();
+        return vec3(u.x(), u.y(), smp.get_1d());
+    }
+
+    struct path_state {
+        // everything a path carries from one bounce to the next (except its sampler)
+        ray current;
+        color throughput;
+        color radiance;
+        bool specular_bounce;       // camera rays count as specular -- emitters are seen directly
+        double bsdf_pdf;            // pdf of the bounce that produced `current`
+        double cone_width;          // ray cone around `current` (stands in for ray differentials) --
+        double cone_spread;         // width at its origin + growth per unit of distance
+
+        path_state(const ray& r, double spread)
+            : current(r), throughput(1, 1, 1), radiance(0, 0, 0), specular_bounce(true), bsdf_pdf(0),
+              cone_width(0), cone_spread(spread) {}
+    };
+
+    template <bool sample_lights, class scene_t, class sampler_t>
+    color ray_color(const ray& r, int depth, const scene_t& world, sampler_t& smp, aov_sample* aov = nullptr,
+                    const cached_hit* replay_hit = nullptr, cached_hit* record_hit = nullptr) const {
+        // iterative path tracer -- `throughput` is the product of all attenuations so far
+        // direct light is sampled at every diffuse hit (next event estimation) and combined with
+        // bsdf sampling through multiple importance sampling (power heuristic)
+        // `sample_lights` is fixed per render: next_event_estimation is on + the scene has lights
+        // the camera ray's hit can come from a hit cache (replay_hit) or be saved to one (record_hit)
+
+        path_state path(r, pixel_spread);
+        for (; depth > 0; depth--) {
+            if (!path_bounce<sample_lights>(path, world, smp, aov, replay_hit, record_hit)) {
+                break;
+            }
+            aov = nullptr;
+            replay_hit = nullptr;
+            record_hit = nullptr;
         }
 
+        return path.radiance;
+    }
+
+    template <bool sample_lights, class scene_t, class sampler_t>
+    bool path_bounce(path_state& path, const scene_t& world, sampler_t& smp, aov_sample* aov,
+                     const cached_hit* replay_hit, cached_hit* record_hit) const {
+        // traces path.current + shades the hit -- false once the path ends
         hit_record rec;
-        if (world->hit(r, interval(0.001, infinity), rec)) {             // the 0.001 fixes shadow acne
-            ray scattered;
-            color attenuation;
+        bool hit;
+        if (replay_hit != nullptr && replay_hit->recorded()) {
+            hit = replay_hit->restore(path.current, *compiled_scene, rec);
+        } else {
+            hit = world.hit(path.current, interval(0.001, infinity), rec);              // the 0.001 fixes shadow acne
+            TRAVERSAL_COUNTERS.rays++;
+        }
+
+        if (record_hit != nullptr) {
+            record_hit->store(hit, rec);
+        }
+
+        // the cone's width where it meets the surface, stretched by the angle it meets it at --
+        // what texture lookups filter over
+        double distance = hit ? rec.t * path.current.direction().length() : 0;
+        if (hit) {
+            double cosine = std::fabs(dot(rec.normal, path.current.direction())) / path.current.direction().length();
+            rec.footprint = (path.cone_width + path.cone_spread * distance) / std::fmax(cosine, 0.05);
+        }
 
-            // scatter has valid calculations
-            if (rec.mat -> scatter(r, rec, attenuation, scattered)){
-                // calculate loss of color by reflection
-                return attenuation * ray_color(scattered, depth-1, world);
+        // first hit data for the denoiser -- only filled on the camera ray
+        if (aov != nullptr) {
+            aov->hit = hit;
+            aov->albedo = hit ? world.albedo_value(rec) : background_color(path.current);
+            aov->normal = hit ? rec.normal : vec3(0, 0, 0);
+            aov->depth = hit ? rec.t * path.current.direction().length() : 0;
+        }
+
+        if (!hit) {
+            path.radiance += path.throughput * background_color(path.current);
+            return false;
+        }
+
+        // emission found by bsdf sampling
+        color emitted = world.emitted(path.current, rec);
+        if (!emitted.near_zero()) {
+            if (path.specular_bounce || !sample_lights) {
+                path.radiance += path.throughput * emitted;
+            } else {
+                double light_pdf = world.light_pdf_value(path.current.origin(), path.current.direction());
+                path.radiance += path.throughput * emitted * power_heuristic(path.bsdf_pdf, light_pdf);
             }
+        }
+
+        // every bounce takes the same dimensions from the sampler, whatever it hits
+        vec3 u_bsdf = get_3d(smp);
+        vec3 u_light = sample_lights ? get_3d(smp) : vec3();
+
+        ray scattered;
+        color attenuation;
+
+        // scatter has valid calculations
+        if (!world.scatter(path.current, rec, u_bsdf, attenuation, scattered)) {
+            return false;
+        }
+
+        bool diffuse = world.is_diffuse(rec);
+        if (diffuse && sample_lights) {
+            path.radiance += path.throughput * sample_direct_light(path.current, rec, world, u_light);
+        }
+
+        // calculate loss of color by reflection
+        path.throughput = path.throughput * attenuation;
+        path.specular_bounce = !diffuse;
+        path.bsdf_pdf = diffuse ? world.scatter_pdf(path.current, rec, scattered.direction()) : 0;
+        path.current = scattered;
+
+        // mirrors + glass keep the cone going (surface curvature is ignored), a diffuse bounce
+        // scatters over the whole hemisphere -- later hits only need coarse texture detail
+        const double diffuse_cone_spread = 0.1;
+        path.cone_width += path.cone_spread * distance;
+        if (diffuse) {
+            path.cone_spread = std::fmax(path.cone_spread, diffuse_cone_spread);
+        }
+        return true;
+    }
+
+    template <class scene_t>
+    color sample_direct_light(const ray& r_in, const hit_record& rec, const scene_t& world, const vec3& u) const {
+        // one shadow ray towards a random light
+        vec3 direction = world.sample_light(rec.p, u);
+        double light_pdf = world.light_pdf_value(rec.p, direction);
+        if (light_pdf <= 0) {
+            return color(0, 0, 0);
+        }
+
+        color f = world.eval(r_in, rec, direction);
+        if (f.near_zero()) {
+            return color(0, 0, 0);
+        }
+
+        // the shadow ray has to reach the nearest light along it without being blocked -- the
+        // lights are intersected on their own (there are few), the rest of the scene only has
+        // to answer whether anything is in between, which stops at the first hit
+        ray shadow(rec.p, direction);
+        hit_record light_rec;
+        TRAVERSAL_COUNTERS.rays++;
+        if (!world.hit_lights(shadow, interval(0.001, infinity), light_rec)) {
+            return color(0, 0, 0);
+        }
+        if (world.occluded(shadow, interval(0.001, light_rec.t))) {
             return color(0, 0, 0);
         }
+        color emitted = world.emitted(shadow, light_rec);
+        if (emitted.near_zero()) {
+            return color(0, 0, 0);
+        }
+
+        double bsdf_pdf = world.scatter_pdf(r_in, rec, direction);
+        return f * emitted * (power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+    }
+
+    color background_color(const ray& r) const {
+        if (!sky_background) {
+            return background;
+        }
 
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5 * (unit_direction.y() + 1.0);
         return (1.0-a) * color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
     }
 
+    static double power_heuristic(double pdf_a, double pdf_b) {
+        double a2 = pdf_a * pdf_a;
+        double b2 = pdf_b * pdf_b;
+        return (a2 + b2) > 0 ? a2 / (a2 + b2) : 0;
+    }
+
 public:
     double aspect_ratio = 1.0;      // ratio of width over height
     int width = 100;                // rendered image width in pixel count 
     int samples_per_pixel = 10;     // Count of random samples for each pixel
     int max_depth = 10;             // Max number of ray bounces into scene
+    sampler_type sampling = sampler_type::sobol;    // where pixel / lens / bounce random numbers come from
+    uint32_t sampler_seed = 0;      // another seed -> another, equally valid noise pattern (not the random sampler)
 
     double vfov         = 90;                   // vertical fov
     point3 lookfrom     = point3(0,0,0);        // point camera is located
@@ -136,319 +361,1131 @@ public:
                                         // everything before plane == perfect focus
                                         // everything past plane   == defocused!!
 
+    bool sky_background = true;                 // sky gradient when rays escape, otherwise `background`
+    color background = color(0, 0, 0);          // flat background color -- use with emissive lights
+    bool next_event_estimation = true;          // sample lights (world.add_light) directly at diffuse hits
+
+    bool output_aovs = false;                   // also write first hit albedo / normal / depth images
+    bool denoise = false;                       // write a denoised image guided by the aovs
+    denoiser denoise_settings;
+
+    bool closed_world = false;                  // devirtualized scene -- spheres / instances + built-in materials only
+    shared_ptr<streamed_scene> streamed_world;  // if set, rendered instead of the hittable_list (out of core spheres)
+
+    pixel_order traversal = pixel_order::hilbert;   // order pixels are rendered in, inside each process' portion
+    int tile_size = 16;                             // tile width + height for morton / hilbert order
+
+    std::string status_file = "";               // if set, a json progress file rewritten twice a second
+    bool pin_workers = false;                   // pin each worker process to its own core (linux only)
+    bool numa_replicate = false;                // with pin_workers + closed world -- one scene copy per numa node
+    std::string hit_cache_file = "";            // closed world + not the random sampler -- camera ray hits are saved here, and
+                                                // reused while the camera + geometry stay the same
+    bool heatmap = false;                       // no shading -- writes false color images of the bvh nodes
+                                                // + primitives each camera ray tests (-nodes / -primitives.ppm)
+    image_format output_format = image_format::ppm;     // beauty image format -- png / qoi are encoded while
+                                                        // the multi process render runs (aovs stay ppm)
+    int output_band_height = 16;                        // rows the streamed encoder waits for at a time
+    bool sort_secondary_rays = false;           // trace a tile's paths a bounce at a time, rays sorted by
+                                                // direction octant + origin before every bounce after the first
+    int secondary_batch_size = 4096;            // paths in flight per sorted batch
+    int texture_cache_mb = 256;                 // image texture tiles kept in memory, per worker process
+    int deadline_calibration_samples = 1;       // deadline_render -- samples every pixel gets before the
+                                                // throughput is known
+
     void render(const hittable_list& world, int min_width, int max_width) {   
         initialize();
+        prepare_scene(&world);
 
         time_t start_time = time(NULL);
 
-        std::ofstream output("assets/output-no-multi-proc.ppm");
-        
-        output << "P3" << std::endl << width << ' ' << height << std::endl << 255 << std::endl;
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            return;
+        }
 
-        double r, g, b;
-        int ir, ig, ib;
-        for (int j = 0; j < height; j++) {
-            // log the progress
-            std::clog << "\rScanlines remaining: " << (height - j) << " " << std::flush;
+        area2d area = {min_width, max_width, 0, height};
+        progress_reporter progress(uint64_t(max_width - min_width) * height, samples_per_pixel, status_file);
+        progress.start();
+        render_portion(&world, &area, render_pass::full(samples_per_pixel), progress.counters(), &fb);
+        progress.stop();
+        std::clog << "Done." << std::endl;
 
-            for (int i = min_width; i < max_width; i++) {
-                color pixel_color(0, 0, 0);
+        write_outputs(fb, "assets/output-no-multi-proc");
 
-                // anti-aliasing
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, &world);
-                }
-                write_color(output, pixel_samples_scale * pixel_color);
+        time_t end_time = time(NULL);
+        std::cout << "Time taken: " << (end_time - start_time) << " seconds (" << pixel_order_name(traversal) << " order)" << std::endl;
+    }
+
+    bool multi_process_render(const hittable_list* world, int min_width, int max_width) {
+        initialize();
+        prepare_scene(world);
+
+        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+        // shared between parent + children -- children write pixels straight into it
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            return false;
+        }
+
+        // shared counters -- children count finished pixels / samples, the parent only reads them
+        progress_reporter progress(uint64_t(width) * height, samples_per_pixel, status_file);
+        progress.start();
+
+        // png / qoi -- children also count finished rows per band, the parent encodes each band
+        // as soon as it is complete instead of the whole image after the last tile
+        const std::string base_path = "assets/output-w-multi-proc";
+        std::unique_ptr<band_tracker> bands;
+        std::unique_ptr<image_stream_writer> stream;
+        if (output_format != image_format::ppm && !heatmap) {
+            bands.reset(new band_tracker(width, height, output_band_height));
+            if (bands->valid()) {
+                output_bands = bands.get();
+                stream.reset(new image_stream_writer(base_path + image_format_extension(output_format), output_format, fb, *bands));
+                stream->start();
             }
         }
-        std::clog << "\rDone.               \n";
 
-        time_t end_time = time(NULL);
-        std::cout << "Time taken: " << (end_time - start_time) << " seconds" << std::endl;
+        bool rendered = fork_render_pass(world, render_pass::full(samples_per_pixel), progress.counters(), &fb);
+        progress.stop();
+        output_bands = nullptr;
+        if (!rendered) {
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+        bool streamed = false;
+        if (stream != nullptr) {
+            streamed = stream->finish();
+            std::chrono::steady_clock::time_point written_time = std::chrono::steady_clock::now();
+            std::cout << "Image ready " << std::chrono::duration_cast<std::chrono::milliseconds>(written_time - end_time).count()
+                      << " ms after the last tile" << std::endl;
+        }
+
+        // Stage 3.4: Write to file
+        write_outputs(fb, base_path, streamed);
+
+        std::clog << "Done." << std::endl;
+        std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()
+                  << " ms (" << pixel_order_name(traversal) << " order)" << std::endl;
+
+        return true;
+
     }
 
-    bool multi_process_render(const hittable_list* world, int min_width, int max_width) {
+    bool progressive_render(const hittable_list* world) {
+        // preview mode -- coarse blocks first, then finer blocks, then more samples per pass
+        // every pass rewrites assets/output-progressive.ppm, the last one is the full quality frame
         initialize();
+        prepare_scene(world);
 
         std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
 
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            return false;
+        }
+
+        progress_reporter progress(uint64_t(width) * height, samples_per_pixel, status_file);
+        progress.start();
+
+        std::vector<render_pass> passes = progressive_schedule(samples_per_pixel);
+        for (size_t i = 0; i < passes.size(); i++) {
+            const render_pass& pass = passes[i];
+            if (!fork_render_pass(world, pass, progress.counters(), &fb)) {
+                progress.stop();
+                return false;
+            }
+
+            if (i + 1 == passes.size()) {
+                break;
+            }
+
+            // preview -- written to a temp file + renamed so an image viewer never reads half of it
+            fill_blocks(fb, pass.block_size);
+            write_ppm("assets/output-progressive.tmp.ppm", fb.color_data(), width, height);
+            std::rename("assets/output-progressive.tmp.ppm", "assets/output-progressive.ppm");
+
+            std::chrono::steady_clock::time_point pass_time = std::chrono::steady_clock::now();
+            std::clog << "\rPass " << (i + 1) << "/" << passes.size() << ": " << pass.block_size << "x" << pass.block_size
+                      << " blocks, " << (pass.first_sample + pass.sample_count) << " spp -- "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(pass_time - start_time).count() << " ms" << std::endl;
+        }
+        progress.stop();
+
+        std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+        write_outputs(fb, "assets/output-progressive");
+
+        std::clog << "Done." << std::endl;
+        std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()
+                  << " ms (progressive, " << passes.size() << " passes)" << std::endl;
+
+        return true;
+    }
+
+    bool deadline_render(const hittable_list* world, double seconds) {
+        // renders for `seconds` of wall time instead of a fixed sample count -- samples_per_pixel
+        // becomes the most any pixel gets. noisy tiles get more samples than clean ones (see
+        // render/deadline.h), every tile's samples per pixel end up in assets/output-deadline-spp.txt
+        initialize();
+        prepare_scene(world);
+
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start_time = clock::now();
+        clock::time_point deadline = start_time + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+
+        // the variance buffer (part of the aovs) is the noise estimate
+        framebuffer fb(width, height, true);
+        if (!fb.valid()) {
+            return false;
+        }
+
+        std::vector<deadline_tile> tiles;
+        for (const area2d& tile : tile_portion({0, width, 0, height}, tile_size, pixel_order::scanline)) {
+            tiles.push_back({tile, 0, 0});
+        }
+        const int tiles_x = (width + std::max(1, tile_size) - 1) / std::max(1, tile_size);
+
+        deadline_queue queue(tiles.size());
+        if (!queue.valid()) {
+            return false;
+        }
+
+        progress_reporter progress(uint64_t(width) * height, samples_per_pixel, status_file);
+        progress.start();
+
+        // round 0 -- a fixed number of samples everywhere, with no time estimate yet
+        std::vector<deadline_job> round;
+        for (size_t i = 0; i < tiles.size(); i++) {
+            round.push_back({tiles[i].tile, int(i), 0, std::min(samples_per_pixel, deadline_calibration_samples), 0, 0});
+        }
+
+        const double margin = std::max(0.01, 0.02 * seconds);
+        const double min_round = std::max(0.05, seconds / 20);
+        double seconds_per_sample = 0;          // wall time per pixel sample, all workers together
+        int rounds = 0;
+
+        while (!round.empty()) {
+            queue.reset(round);
+            clock::time_point round_start = clock::now();
+            if (!fork_deadline_round(world, queue, progress.counters(), &fb, deadline)) {
+                progress.stop();
+                return false;
+            }
+            double round_seconds = std::chrono::duration<double>(clock::now() - round_start).count();
+            rounds++;
+
+            double pixel_samples = 0;
+            for (size_t j = 0; j < queue.size(); j++) {
+                const deadline_job& job = queue[j];
+                if (job.done) {
+                    deadline_tile& t = tiles[job.tile_index];
+                    t.samples += job.sample_count;
+                    t.error = tile_error(fb, t.tile, t.samples);
+                    pixel_samples += double(job.sample_count) * t.pixel_count();
+                }
+            }
+            if (pixel_samples > 0) {
+                seconds_per_sample = round_seconds / pixel_samples;
+            }
+
+            // the next round gets half of what is left, or all of it once that gets short
+            double remaining = std::chrono::duration<double>(deadline - clock::now()).count() - margin;
+            if (remaining <= 0 || seconds_per_sample <= 0) {
+                break;
+            }
+            double round_time = remaining < 2 * min_round ? remaining : std::max(min_round, remaining / 2);
+
+            // a job's own wall time is its samples at one worker's share of the throughput
+            double job_seconds = seconds_per_sample * render_process_count;
+            double max_job_pixel_samples = std::max(1.0, round_time / 4 / job_seconds);
+            round = plan_deadline_round(tiles, round_time / seconds_per_sample, samples_per_pixel, max_job_pixel_samples, job_seconds);
+        }
+        progress.stop();
+
+        clock::time_point end_time = clock::now();
+
+        const std::string base_path = "assets/output-deadline";
+        write_outputs(fb, base_path);
+        write_deadline_report(base_path + "-spp.txt", tiles, tiles_x);
+
+        int min_spp = samples_per_pixel, max_spp = 0;
+        double pixel_samples = 0;
+        for (const deadline_tile& t : tiles) {
+            min_spp = std::min(min_spp, t.samples);
+            max_spp = std::max(max_spp, t.samples);
+            pixel_samples += double(t.samples) * t.pixel_count();
+        }
+
+        std::clog << "Done." << std::endl;
+        std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()
+                  << " ms of a " << int(seconds * 1000) << " ms budget (" << rounds << " rounds) -- spp per tile "
+                  << min_spp << " to " << max_spp << ", " << pixel_samples / (double(width) * height) << " on average" << std::endl;
+        return true;
+    }
+
+    bool fork_deadline_round(const hittable_list* world, deadline_queue& queue, progress_counters* progress, framebuffer* fb,
+                             std::chrono::steady_clock::time_point deadline) {
+        // every worker takes jobs off the shared queue until it is empty
+        std::vector<logical_cpu> order = topology.worker_order();
+        std::vector<pid_t> children;
+        for (int i = 0; i < render_process_count; i++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                continue;
+            } else if (pid == 0) {
+                if (pin_workers && !order.empty()) {
+                    pin_to_cpus(std::vector<int>(1, order[i % order.size()].cpu));
+                }
+                render_deadline_jobs(world, queue, progress, fb, deadline);
+                _exit(0);
+            }
+            children.push_back(pid);
+        }
+
+        if (children.empty()) {
+            std::cerr << "Error: invalid thread count" << std::endl;
+            return false;
+        }
+        for (pid_t child : children) {
+            waitpid(child, NULL, 0);
+        }
+        return true;
+    }
+
+    void render_deadline_jobs(const hittable_list* world, deadline_queue& queue, progress_counters* progress, framebuffer* fb,
+                              std::chrono::steady_clock::time_point deadline) {
+        // jobs that would end past the deadline are left undone -- their tiles keep the samples
+        // they already have. a tile's first samples (round 0) are always rendered, even late:
+        // a tile without any would come out black
+        for (deadline_job* job = queue.next(); job != nullptr; job = queue.next()) {
+            std::chrono::duration<double> left = deadline - std::chrono::steady_clock::now();
+            if (job->first_sample > 0 && left.count() <= job->predicted_seconds) {
+                continue;
+            }
+
+            const area2d& tile = job->tile;
+            std::vector<pixel_coord> pixels = curve_cells(tile.max_x - tile.min_x, tile.max_y - tile.min_y, traversal);
+            render_pass pass = {1, 0, job->first_sample, job->sample_count};
+            uint64_t rays = TRAVERSAL_COUNTERS.rays;
+            (this->*render_tile_kernel)(world, tile, pixels, pass, fb);
+            job->done = 1;
+
+            if (progress != nullptr) {
+                progress->add(pass.first_sample == 0 ? pixels.size() : 0, uint64_t(pixels.size()) * pass.sample_count, TRAVERSAL_COUNTERS.rays - rays);
+            }
+        }
+
+        if (streamed_world != nullptr) {
+            streamed_world->flush_statistics();
+        }
+        shared_texture_cache().flush_statistics();
+    }
+
+    bool fork_render_pass(const hittable_list* world, const render_pass& pass, progress_counters* progress, framebuffer* fb) {
+        // splits the image into column strips, one child process each, and waits for all of them
+        // children only render + _exit, so the parent's reporter thread is never touched by them
+
         // Goal: max # of processes = (max # for computer)
         // Stage 1.1: groundwork
-        // int process_count = sysconf(_SC_NPROCESSORS_ONLN) - 1;
-        const int process_count = 7; 
+        const int process_count = render_process_count;
         if (process_count < 0) { // less than 1 core
             std::cerr << "Error: invalid number of processes" << std::endl;
             return false;
         }
-        int valid_threads = 0;
-        
-        pipe_file_directory pipefd[process_count];
-        pid_t children[process_count];
-        std::ofstream files[process_count];
-        std::mutex cout_mutex;
-
-        for (int i = 0; i < process_count; i++) {
-            files[i].open("assets/output" + std::to_string(i) + ".chk", std::ios::out | std::ios::trunc);
-            if (!files[i].is_open()) {
-                std::cerr << "Error: file failed to open" << std::endl;
-                return false;
-            }
+
+        // Stage 1.2: place workers -- pinned workers get cpus in topology order
+        std::vector<logical_cpu> order = topology.worker_order();
+        std::vector<int> worker_cpu(process_count, -1);
+        std::vector<int> worker_node(process_count, 0);
+        for (int i = 0; pin_workers && !order.empty() && i < process_count; i++) {
+            worker_cpu[i] = order[i % order.size()].cpu;
+            worker_node[i] = order[i % order.size()].node;
         }
 
-        // Stage 1.2: create pipes and batch children
-        std::cout << "Creating Child Processes" << std::endl;
-        for (int i = 0; i < process_count; i++) {
-            // create pipes
-            int tpipefd[2];
-            if (pipe(tpipefd) == -1) {
-                std::cerr << "Error: pipe failed" << std::endl;
-                return false;
+        bool replicate = numa_replicate && pin_workers && compiled_scene != nullptr && topology.node_count > 1;
+        if (!replicate) {
+            std::vector<int> workers;
+            for (int i = 0; i < process_count; i++) workers.push_back(i);
+            return fork_workers(world, pass, progress, fb, process_count, workers, worker_cpu) == process_count;
+        }
+
+        // Stage 1.3: numa replication -- one leader process per node copies the scene while pinned
+        // to that node (pages land in local memory on first touch), then forks the node's workers,
+        // which share the leader's copy
+        std::vector<pid_t> leaders;
+        for (int node = 0; node < topology.node_count; node++) {
+            std::vector<int> workers;
+            for (int i = 0; i < process_count; i++) {
+                if (worker_node[i] == node) workers.push_back(i);
             }
-            pipefd[i] = {tpipefd[0], tpipefd[1]};
+            if (workers.empty()) continue;
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                continue;
+            } else if (pid == 0) {
+                pin_to_cpus(topology.node_cpus(node));
+                compiled_scene = make_shared<closed_scene>(*compiled_scene);
 
+                int started = fork_workers(world, pass, progress, fb, process_count, workers, worker_cpu);
+                _exit(started == int(workers.size()) ? 0 : 1);
+            }
+            leaders.push_back(pid);
+        }
+
+        bool complete = !leaders.empty();
+        for (pid_t leader : leaders) {
+            int status = 0;
+            waitpid(leader, &status, 0);
+            complete = complete && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        return complete;
+    }
+
+    int fork_workers(const hittable_list* world, const render_pass& pass, progress_counters* progress, framebuffer* fb,
+                     int process_count, const std::vector<int>& workers, const std::vector<int>& worker_cpu) {
+        // forks + waits for the given workers (strip indices) -- returns how many started
+        int valid_threads = 0;
+        
+        std::vector<pid_t> children(workers.size(), -1);
+
+        // Stage 1.2: batch children
+        for (size_t w = 0; w < workers.size(); w++) {
             // fork child processes
+            int i = workers[w];
             
-            min_width = (width / process_count) * i;
-            max_width = (i == process_count - 1) ? width : (width / process_count) * (i + 1);
+            int min_width = (width / process_count) * i;
+            int max_width = (i == process_count - 1) ? width : (width / process_count) * (i + 1);
 
             pid_t pid = fork();
             if (pid < 0) {
-                // close child pipes
-                close(pipefd[i].read);
-                close(pipefd[i].write);
                 // flag child as failed
-                children[i] = -1;
+                children[w] = -1;
                 continue;
             } else if (pid == 0) {          // active child script
-                // close reading pipe -- child does not read
-                close(pipefd[i].read);
-
-                // Stage 2.1: open file io -- write to file
-                // Child: i | OPEN
-                const char* message = "OPEN";
-                write(pipefd[i].write, message, strlen(message) + 1);
-
-                // Stage 2.2: render section
-                std::cout << "Rendering in child process: " << i << std::endl;
-                
-                // begin rendering
-                area2d area = {min_width, max_width, 0, height};
-                render_portion(world, &area, &pipefd[i], &files[i]);
-
-                // close file
-                files[i].close();
-
-                // Stage 2.3: write to pipe when finished
-                // Child: i | FINISHED
-                message = "FINISHED";
-                write(pipefd[i].write, message, strlen(message) + 1);
-
-                std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+                if (worker_cpu[i] >= 0) {
+                    pin_to_cpus(std::vector<int>(1, worker_cpu[i]));
+                }
 
-                message = ("TIME " + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time).count())).c_str();
-                write(pipefd[i].write, message, strlen(message) + 1);
+                // Stage 2.1: render section
+                area2d area = {min_width, max_width, 0, height};
+                render_portion(world, &area, pass, progress, fb);
 
-                // Stage 2.4: clean
-                // close write pipe
-                close(pipefd[i].write);
-                exit(0);
+                // Stage 2.2: clean
+                // _exit -- skip the parent's atexit handlers + stream flushes in the child
+                _exit(0);
 
             } else {                        // active parent script
-                // TODO _ potentially get the parent to all 
-                // perform calculations
-                children[i] = pid;
+                children[w] = pid;
                 valid_threads ++;
-
-                std::cout << "Created Child: " << i << std::endl;
             }
         }
 
         // Stage 3: run parent script info
-        //      - reads from the pipes of child processes
-        //      - stores data into a buffer
-        //      - writes to the .ppm file (at the very end)
-        
-        std::cout << "Stage 3 -- Starting to read from child processes" << std::endl;
+        //      - the reporter thread reads the shared counters until the children exit
+        //      - children write pixels into the shared framebuffer
 
         // Stage 3.1: check if valid resources
         if (valid_threads <= 0) {
             std::cerr << "Error: invalid thread count" << std::endl;
-            return false;
+            return 0;
         }
 
-        // Stage 3.2: read from pipes
-        std::atomic<int> lines_rendered(0);
-        // TODO - implement threading to read from all pipes
-        std::vector<std::thread> readers;
-        readers.reserve(process_count);
+        // Stage 3.2: clean
+        for (pid_t child : children) {
+            if (child > 0) {
+                waitpid(child, NULL, 0);
+            }
+        }
 
-        
+        // a failed fork leaves its strip empty
+        return valid_threads;
+    }
 
-        for (int i = 0; i < process_count; i++) {
-            if (children[i] > 0) {      // if is valid child process
-                
-                // launch a thread to read
-                readers.emplace_back([this, i, &pipefd, &lines_rendered, &cout_mutex]() {
-                    char buffer[256];
-
-                    // continuously read until EOF or error
-                    while (true) {
-                        ssize_t bytes_read = read(pipefd[i].read, buffer, sizeof(buffer) - 1);
-                        if (bytes_read <= 0) {
-                            // bytes_read == 0 -- means it is EOF
-                            // bytes_read < 0 -- means there was an error
-                            break;
-                        }
-
-                        // nbull terminated and print or process the data
-                        buffer[bytes_read] = '\0';
-
-                        // check if a certain prefix is present
-                        if (strncmp(buffer, "OPEN", 4) == 0 || strncmp(buffer, "FINISHED", 8) == 0) {
-                            std::lock_guard<std::mutex> lock(cout_mutex);
-                            std::cout << "Child " << i << " says | OPEN" << std::endl;
-                        } else if (strncmp(buffer, "UPDATE", 6) == 0) {
-                            lines_rendered.fetch_add(1);
-                            {
-                                std::lock_guard<std::mutex> lock(cout_mutex);
-                                std::clog << "\rScanlines remaining: " << (height * process_count - lines_rendered.load()) << " " << std::flush;
-                            }
-                        } else if(strncmp(buffer, "TIME", 4) == 0) {
-                            std::lock_guard<std::mutex> lock(cout_mutex);
-                            std::cout << "Child " << i << " says | " << buffer << std::endl;
-                        }else {
-                            std::lock_guard<std::mutex> lock(cout_mutex);
-                            std::cout << "Child " << i << " says | " << buffer << std::endl;
-                        }
-                    }
-                    
-                });
-            }
+    bool benchmark_pinning(const hittable_list* world) {
+        // renders the frame unpinned, then pinned (+ numa replicated if numa_replicate is set),
+        // and prints the throughput of both -- no images are written
+        bool pinned_setting = pin_workers;
+        initialize();
+        pin_workers = true;
+        prepare_scene(world);
+
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            pin_workers = pinned_setting;
+            return false;
         }
 
-        // Stage 3.3: clean
-        // close processes + pipes
-        std::cout << "Closing Child Processes" << std::endl;
-        for (int i = 0; i < process_count; i++) {
-            if (children[i] > 0) {
-                waitpid(children[i], NULL, 0);
-                close(pipefd[i].read);
-                close(pipefd[i].write);
+        double samples = double(width) * height * samples_per_pixel;
+        double rates[2];
+        for (int pinned = 0; pinned < 2; pinned++) {
+            pin_workers = pinned == 1;
 
-                std::cout << "Closed Child: " << i << std::endl;
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+            if (!fork_render_pass(world, render_pass::full(samples_per_pixel), nullptr, &fb)) {
+                pin_workers = pinned_setting;
+                return false;
             }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            rates[pinned] = seconds > 0 ? samples / seconds : 0;
         }
+        pin_workers = pinned_setting;
 
-        // join the threads
-        for (auto& reader : readers) {
-            reader.join();
+        std::cout << "Unpinned: " << rates[0] * 1e-6 << " M samples/s" << std::endl;
+        std::cout << "Pinned" << (numa_replicate ? " + replicated" : "") << ": " << rates[1] * 1e-6 << " M samples/s ("
+                  << (rates[0] > 0 ? 100.0 * (rates[1] / rates[0] - 1) : 0) << "%)" << std::endl;
+        return true;
+    }
+
+    bool distributed_render(const hittable_list* world, const std::string& address, int local_workers) {
+        // coordinator -- listens on `address` ("unix:/path" or "tcp:host:port") and hands tiles to
+        // every worker that connects, in the order they ask for them
+        // `local_workers` are forked here; workers on other hosts run render_worker with the same
+        // scene + camera settings
+        initialize();
+        prepare_scene(world);
+
+        int listen_fd = listen_on(address);
+        if (listen_fd < 0) {
+            std::cerr << "Error: cannot listen on " << address << std::endl;
+            return false;
         }
 
-        // Stage 3.4: Write to file
-        std::ifstream files_read[process_count];
-        int* buffer = new int[height * width * 3];
+        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
 
-        std::ofstream log_file("assets/output.log", std::ios::out | std::ios::trunc);
-        if (!log_file.is_open()) {
-            std::cerr << "Error: log file failed to open" << std::endl;
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            close(listen_fd);
             return false;
         }
 
-        // read each file and load data into the buffer ( RAW FILE )
-        const char* base_dir = "assets/output";
-        for (int i = 0; i < process_count; i++) {
-            files_read[i].open(base_dir + std::to_string(i) + ".chk");
-            
-            // check if file opened
-            if (!files_read[i].is_open()) {
-                std::cerr << "Error: file failed to open" << std::endl;
-                return false;
+        std::vector<pid_t> children;
+        for (int i = 0; i < local_workers; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                int fd = connect_to(address);
+                bool ok = fd >= 0 && serve_tiles(world, fd);
+                _exit(ok ? 0 : 1);
             }
+            if (pid > 0) children.push_back(pid);
+        }
+
+        progress_reporter progress(uint64_t(width) * height, samples_per_pixel, status_file);
+        progress.start();
+
+        tile_coordinator coordinator(camera_key());
+        bool rendered = coordinator.run(listen_fd, portion_tiles({0, width, 0, height}), fb, progress.counters(), samples_per_pixel);
+        progress.stop();
+        close(listen_fd);
+        if (address.compare(0, 5, "unix:") == 0) {
+            unlink(address.substr(5).c_str());
         }
 
-        // open the output file
-        std::ofstream output("assets/output-w-multi-proc.ppm");
-        if (!output.is_open()) {
-            std::cerr << "Error: output file failed to open" << std::endl;
+        for (pid_t child : children) {
+            waitpid(child, NULL, 0);
+        }
+        if (!rendered) {
             return false;
         }
 
-        // dump image buffer into the output file
-        output << "P3" << std::endl << width << ' ' << height << std::endl << 255 << std::endl;
+        std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
 
-        std::pair<int, int> sizes[process_count];
-        std::string tmp;
-        for (int i = 0; i < process_count; i++) {
-            getline(files_read[i], tmp);
-            // width + height
-            getline(files_read[i], tmp);
-            std::stringstream ss(tmp);
-            ss >> sizes[i].first >> sizes[i].second;
-            // format
-            getline(files_read[i], tmp);
-            // TODO - do something with that data
+        write_outputs(fb, "assets/output-distributed");
+
+        std::clog << "Done." << std::endl;
+        std::cout << "Render time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count()
+                  << " ms (distributed, " << local_workers << " local workers)" << std::endl;
+        return true;
+    }
+
+    bool render_worker(const hittable_list* world, const std::string& address) {
+        // worker -- renders the tiles a distributed_render coordinator hands out until it says done
+        // the scene + camera settings must match the coordinator's (checked through camera_key)
+        initialize();
+        prepare_scene(world);
+
+        int fd = connect_to(address);
+        if (fd < 0) {
+            std::cerr << "Error: cannot connect to " << address << std::endl;
+            return false;
         }
+        return serve_tiles(world, fd);
+    }
 
-        // all chk files read as --> (pixel, pixel, pixel on every line [from left to right, top to bottom])
-        for (int y = 0; y < height; y++) {
-            for (int i = 0; i < process_count; i++) {
-                int r, g, b;
+    bool serve_tiles(const hittable_list* world, int fd) {
+        // camera already initialized -- the worker loop of render_worker, over a connected socket
+        framebuffer fb(width, height, output_aovs || denoise);
+        if (!fb.valid()) {
+            close(fd);
+            return false;
+        }
+
+        tile_message hello = make_message(tile_hello);
+        hello.key = camera_key();
+        bool ok = send_message(fd, hello);
+
+        std::vector<float> payload;
+        tile_message job;
+        while (ok && read_all(fd, &job, sizeof(job)) && job.type == tile_job) {
+            render_portion(world, &job.area, render_pass::full(samples_per_pixel), nullptr, &fb);
+
+            fb.pack_tile(job.area, payload);
+            tile_message result = make_message(tile_result);
+            result.tile = job.tile;
+            result.payload_floats = uint32_t(payload.size());
+            ok = send_message(fd, result, payload.data());
+        }
+
+        close(fd);
+        return ok;
+    }
+
+    void prepare(const hittable_list* world) {
+        // everything the render entry points do before rendering -- for callers that drive
+        // render_portion themselves (render_server)
+        initialize();
+        prepare_scene(world);
+    }
 
-                for (int x = 0; x < sizes[i].first; x++) {
-                    files_read[i] >> r >> g >> b;
-                    output << r << ' ' << g << ' ' << b << std::endl;
+    void prepare_job(const hittable_list* world) {
+        // a copy of a camera that went through prepare(), with changed settings -- keeps the
+        // compiled scene of the original, only redoes the per frame setup
+        initialize();
+        primary_hits = nullptr;
+        replay_primary_hits = false;
+        render_tile_kernel = select_render_kernel(world->has_lights());
+    }
+
+    std::vector<area2d> portion_tiles(const area2d& portion) const {
+        // rows (scanline) or tiles along a space filling curve
+        std::vector<area2d> tiles;
+        if (traversal == pixel_order::scanline) {
+            for (int y = portion.min_y; y < portion.max_y; y++) {
+                tiles.push_back({portion.min_x, portion.max_x, y, y + 1});
+            }
+        } else {
+            tiles = tile_portion(portion, tile_size, traversal);
+        }
+        return tiles;
+    }
+
+    void render_portion(const hittable_list* world, area2d *portion, const render_pass& pass, progress_counters *progress, framebuffer *fb) {
+        // camera already initialized
+        // renders the pixels + samples of `pass` that fall inside `portion`
+        // pixels are written into `fb`, finished work is counted in `progress` (may be null)
+        // work goes row by row (scanline) or tile by tile along a space filling curve
+        for (const area2d& tile : portion_tiles(*portion)) {
+            std::vector<pixel_coord> pixels;
+            for (const pixel_coord& pixel : curve_cells(tile.max_x - tile.min_x, tile.max_y - tile.min_y, traversal)) {
+                if (pass.includes(tile.min_x + pixel.x, tile.min_y + pixel.y)) {
+                    pixels.push_back(pixel);
                 }
             }
+            if (pixels.empty()) {
+                continue;
+            }
+
+            uint64_t rays = TRAVERSAL_COUNTERS.rays;
+            (this->*render_tile_kernel)(world, tile, pixels, pass, fb);
+
+            if (progress != nullptr) {
+                // pixels count once -- on their first sample
+                progress->add(pass.first_sample == 0 ? pixels.size() : 0, uint64_t(pixels.size()) * pass.sample_count, TRAVERSAL_COUNTERS.rays - rays);
+            }
+            if (output_bands != nullptr) {
+                output_bands->add(tile);
+            }
         }
 
+        if (streamed_world != nullptr) {
+            streamed_world->flush_statistics();
+        }
+        shared_texture_cache().flush_statistics();
+    }
+
+    // ----------------------------------------------------- //
+    // render kernels
+    // ----------------------------------------------------- //
+    // one tile of pixels (in the order given by `pixels`, relative to the tile corner), compiled
+    // once per combination of render settings -- the settings are fixed for a whole render, so
+    // they are template arguments instead of runtime branches
 
-        // close all files
-        for (int i = 0; i < process_count; i++) {
-            files_read[i].close();
+    typedef void (camera::*tile_kernel)(const hittable_list* world, const area2d& tile, const std::vector<pixel_coord>& pixels, const render_pass& pass, framebuffer *fb) const;
+
+    virtual_scene scene_view(const hittable_list* world, const virtual_scene*) const {
+        return virtual_scene(world);
+    }
+
+    const closed_scene& scene_view(const hittable_list* world, const closed_scene*) const {
+        return *compiled_scene;
+    }
+
+    const streamed_scene& scene_view(const hittable_list* world, const streamed_scene*) const {
+        return *streamed_world;
+    }
+
+    struct pixel_sums {
+        // one pixel's samples of this pass, summed
+        color radiance;
+        color albedo;
+        vec3 normal;
+        double depth = 0;
+        int depth_samples = 0;
+        double luminance_sum = 0, luminance_squared_sum = 0;
+
+        void add(const color& sample_color, const aov_sample& aov) {
+            double l = luminance(sample_color);
+            radiance += sample_color;
+            luminance_sum += l;
+            luminance_squared_sum += l * l;
+            albedo += aov.albedo;
+            normal += aov.normal;
+            if (aov.hit) {
+                depth += aov.depth;
+                depth_samples++;
+            }
+        }
+    };
+
+    template <class scene_t, class sampler_t, bool depth_of_field, bool sample_lights>
+    void render_tile(const hittable_list* scene, const area2d& tile, const std::vector<pixel_coord>& pixels, const render_pass& pass, framebuffer *fb) const {
+        const scene_t& world = scene_view(scene, static_cast<const scene_t*>(nullptr));
+        bool aovs = fb->has_aovs();
+
+        // camera rays are made 8 samples at a time (get_rays) -- every sample of a group
+        // continues on its own copy of the sampler
+        const int group_size = 8;
+        sampler_t group_smp[group_size];
+        ray group_rays[group_size];
+        for (int k = 0; k < group_size; k++) {
+            group_smp[k] = sampler_t(samples_per_pixel, sampler_seed);
         }
-        output.close();
 
-        std::clog << "\rDone.               \n";
+        const int total_samples = pass.first_sample + pass.sample_count;
 
-        return true;
+        for (const pixel_coord& pixel : pixels) {
+            int x = tile.min_x + pixel.x;
+            int y = tile.min_y + pixel.y;
+            pixel_sums sums;
+
+            // aa
+            for(int sample = pass.first_sample; sample < total_samples; sample++) {
+                int k = (sample - pass.first_sample) % group_size;
+                if (k == 0) {
+                    get_rays<depth_of_field, group_size>(x, y, sample, std::min(group_size, total_samples - sample), group_smp, group_rays);
+                }
+                sampler_t& smp = group_smp[k];
+                const ray& r = group_rays[k];
 
+                cached_hit* cached = primary_hits != nullptr ? primary_hits->at(x, y, sample) : nullptr;
+                const cached_hit* replay_hit = replay_primary_hits ? cached : nullptr;
+                cached_hit* record_hit = replay_primary_hits ? nullptr : cached;
+
+                if (!aovs) {
+                    sums.radiance += ray_color<sample_lights>(r, max_depth, world, smp, nullptr, replay_hit, record_hit);
+                    continue;
+                }
+
+                aov_sample aov;
+                color sample_color = ray_color<sample_lights>(r, max_depth, world, smp, &aov, replay_hit, record_hit);
+                sums.add(sample_color, aov);
+            }
+
+            store_pixel(fb, x, y, pass, sums);
+        }
     }
 
-    void render_portion(const hittable_list* world, area2d *portion, pipe_file_directory *pipefd, std::ofstream *file) {
-        // camera already initialized
-        // header data already outputted
-        
-        double r, g, b;
-        int ir, ig, ib;
+    template <class sampler_t>
+    struct queued_path {
+        // a path waiting for its next bounce in a sorted batch -- carries its own sampler, so the
+        // dimensions it draws do not depend on the order the batch is traced in
+        path_state path;
+        sampler_t smp;
+        int depth;                  // bounces left
+        int slot;                   // (pixel, sample) of the batch it belongs to
+
+        queued_path(const ray& r, double spread, const sampler_t& smp, int depth, int slot)
+            : path(r, spread), smp(smp), depth(depth), slot(slot) {}
+    };
+
+    template <class scene_t, class sampler_t, bool depth_of_field, bool sample_lights>
+    void render_sorted_tile(const hittable_list* scene, const area2d& tile, const std::vector<pixel_coord>& pixels, const render_pass& pass, framebuffer *fb) const {
+        // same image as render_tile, traced breadth first: a batch of (pixel, sample) paths takes
+        // one bounce at a time. camera rays go in pixel order (already coherent), the rays still
+        // alive after that are sorted by direction octant + origin before every later bounce
+        const scene_t& world = scene_view(scene, static_cast<const scene_t*>(nullptr));
+        sampler_t smp(samples_per_pixel, sampler_seed);
+        bool aovs = fb->has_aovs();
+
+        const size_t slot_count = pixels.size() * pass.sample_count;
+        const size_t batch_size = size_t(std::max(1, secondary_batch_size));
+
+        std::vector<queued_path<sampler_t>> active, sorted;
+        std::vector<ray_sort_entry> keys, scratch;
+        std::vector<color> results;
+        std::vector<aov_sample> first_hits;
+
+        size_t pixel_index = 0;
+        pixel_sums sums;
+
+        for (size_t begin = 0; begin < slot_count; begin += batch_size) {
+            size_t end = std::min(slot_count, begin + batch_size);
+            results.assign(end - begin, color(0, 0, 0));
+            first_hits.assign(aovs ? end - begin : 0, aov_sample());
+
+            // bounce 1 -- camera rays, straight from the pixel order
+            active.clear();
+            for (size_t slot = begin; slot < end && max_depth > 0; slot++) {
+                const pixel_coord& pixel = pixels[slot / pass.sample_count];
+                int x = tile.min_x + pixel.x;
+                int y = tile.min_y + pixel.y;
+                int sample = pass.first_sample + int(slot % pass.sample_count);
+
+                smp.start_pixel_sample(x, y, sample);
+                ray r = get_ray<depth_of_field>(x, y, smp);
+
+                cached_hit* cached = primary_hits != nullptr ? primary_hits->at(x, y, sample) : nullptr;
+                const cached_hit* replay_hit = replay_primary_hits ? cached : nullptr;
+                cached_hit* record_hit = replay_primary_hits ? nullptr : cached;
+
+                active.emplace_back(r, pixel_spread, smp, max_depth, int(slot - begin));
+                queued_path<sampler_t>& q = active.back();
+                aov_sample* aov = aovs ? &first_hits[q.slot] : nullptr;
+                if (!path_bounce<sample_lights>(q.path, world, q.smp, aov, replay_hit, record_hit) || --q.depth == 0) {
+                    results[q.slot] = q.path.radiance;
+                    active.pop_back();
+                }
+            }
 
-        *file << "P3" << std::endl << (portion->max_x - portion->min_x) << ' ' << (portion->max_y - portion->min_y) << std::endl << 255 << std::endl;
+            // bounces 2+ -- sorted, then traced + compacted in place
+            while (!active.empty()) {
+                sort_paths(active, sorted, keys, scratch);
 
-        for(int y = portion->min_y; y < portion->max_y; y++) {
-            // TODO -- log process 
-            const char* message = "UPDATE";
-            write(pipefd->write, message, strlen(message) + 1);
+                size_t alive = 0;
+                for (size_t i = 0; i < active.size(); i++) {
+                    queued_path<sampler_t>& q = active[i];
+                    if (!path_bounce<sample_lights>(q.path, world, q.smp, nullptr, nullptr, nullptr) || --q.depth == 0) {
+                        results[q.slot] = q.path.radiance;
+                        continue;
+                    }
+                    if (alive != i) active[alive] = std::move(q);
+                    alive++;
+                }
+                active.erase(active.begin() + alive, active.end());
+            }
 
-            for (int x = portion->min_x; x < portion->max_x; x++) {
+            // sums in (pixel, sample) order, like render_tile -- a pixel can span batches
+            for (size_t slot = begin; slot < end; slot++) {
+                if (aovs) {
+                    sums.add(results[slot - begin], first_hits[slot - begin]);
+                } else {
+                    sums.radiance += results[slot - begin];
+                }
 
-                color pixel_color(0, 0, 0);
-                // aa
-                for(int sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(x, y);
-                    pixel_color += ray_color(r, max_depth, world);
+                if ((slot + 1) % pass.sample_count == 0) {
+                    const pixel_coord& pixel = pixels[pixel_index++];
+                    store_pixel(fb, tile.min_x + pixel.x, tile.min_y + pixel.y, pass, sums);
+                    sums = pixel_sums();
                 }
+            }
+        }
+    }
+
+    template <class sampler_t>
+    static void sort_paths(std::vector<queued_path<sampler_t>>& active, std::vector<queued_path<sampler_t>>& sorted,
+                           std::vector<ray_sort_entry>& keys, std::vector<ray_sort_entry>& scratch) {
+        if (active.size() < 2) {
+            return;
+        }
+
+        // origins are quantized inside this batch's bounds -- as fine as the grid can get
+        point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+        for (const queued_path<sampler_t>& q : active) {
+            const point3& o = q.path.current.origin();
+            for (int axis = 0; axis < 3; axis++) {
+                low[axis] = std::min(low[axis], o[axis]);
+                high[axis] = std::max(high[axis], o[axis]);
+            }
+        }
+        ray_sort_bounds bounds = ray_sort_bounds::of(low, high);
+
+        keys.resize(active.size());
+        for (size_t i = 0; i < active.size(); i++) {
+            keys[i] = {ray_sort_key(active[i].path.current.origin(), active[i].path.current.direction(), bounds), uint32_t(i)};
+        }
+        sort_ray_keys(keys, scratch);
+
+        // move the paths themselves, so the trace loop walks memory front to back
+        sorted.clear();
+        sorted.reserve(active.size());
+        for (const ray_sort_entry& entry : keys) {
+            sorted.push_back(std::move(active[entry.index]));
+        }
+        active.swap(sorted);
+    }
+
+    void store_pixel(framebuffer* fb, int x, int y, const render_pass& pass, pixel_sums& sums) const {
+        // the pixel already holds the average of pass.first_sample samples -- blend into it
+        bool aovs = fb->has_aovs();
+        const int total_samples = pass.first_sample + pass.sample_count;
+        const double sample_scale = 1.0 / total_samples;
+
+        if (pass.first_sample > 0) {
+            // turn the stored averages back into sums over the earlier samples
+            double n = pass.first_sample;
+            color previous_color = fb->get_color(x, y);
+            sums.radiance += n * previous_color;
+
+            if (aovs) {
+                color previous_albedo;
+                vec3 previous_normal;
+                double previous_depth, previous_variance;
+                fb->get_aovs(x, y, previous_albedo, previous_normal, previous_depth, previous_variance);
+
+                double previous_mean = luminance(previous_color);
+                sums.luminance_sum += n * previous_mean;
+                sums.luminance_squared_sum += n * (previous_variance * n + previous_mean * previous_mean);
+                sums.albedo += n * previous_albedo;
+                sums.normal += n * previous_normal;
+                if (previous_depth > 0) {
+                    sums.depth += n * previous_depth;
+                    sums.depth_samples += pass.first_sample;
+                }
+            }
+        }
+
+        fb->set_color(x, y, sample_scale * sums.radiance);
+        if (aovs) {
+            // normals are averaged then renormalized -- misses leave a zero normal
+            vec3 normal = sums.normal.near_zero() ? sums.normal : unit_vector(sums.normal);
+
+            // variance of the mean = sample variance / n
+            double mean = sums.luminance_sum * sample_scale;
+            double variance = std::max(0.0, sums.luminance_squared_sum * sample_scale - mean * mean) * sample_scale;
+
+            fb->set_aovs(x, y, sample_scale * sums.albedo, normal,
+                         sums.depth_samples > 0 ? sums.depth / sums.depth_samples : 0, variance);
+        }
+    }
+
+    template <class scene_t, class sampler_t, bool depth_of_field>
+    void render_heatmap_tile(const hittable_list* scene, const area2d& tile, const std::vector<pixel_coord>& pixels, const render_pass& pass, framebuffer *fb) const {
+        // camera rays only -- the pixel color holds the average (nodes, primitives, 0) tested per ray
+        const scene_t& world = scene_view(scene, static_cast<const scene_t*>(nullptr));
+        sampler_t smp(samples_per_pixel, sampler_seed);
+
+        const int total_samples = pass.first_sample + pass.sample_count;
+
+        for (const pixel_coord& pixel : pixels) {
+            int x = tile.min_x + pixel.x;
+            int y = tile.min_y + pixel.y;
+
+            double nodes = 0, primitives = 0;
+            for (int sample = pass.first_sample; sample < total_samples; sample++) {
+                smp.start_pixel_sample(x, y, sample);
+                ray r = get_ray<depth_of_field>(x, y, smp);
 
-                // write to ostream file
-                // *file << x << ' ' << y << ' ';
-                write_color(*file, pixel_samples_scale * pixel_color);
+                TRAVERSAL_COUNTERS = traversal_counters();
+                hit_record rec;
+                world.hit(r, interval(0.001, infinity), rec);
+                nodes += TRAVERSAL_COUNTERS.nodes;
+                primitives += TRAVERSAL_COUNTERS.primitives;
+            }
 
+            if (pass.first_sample > 0) {
+                color previous = fb->get_color(x, y);
+                nodes += pass.first_sample * previous.x();
+                primitives += pass.first_sample * previous.y();
             }
+
+            fb->set_color(x, y, color(nodes / total_samples, primitives / total_samples, 0));
+        }
+    }
+
+    tile_kernel select_render_kernel(bool scene_has_lights) const {
+        if (streamed_world != nullptr) {
+            return select_sampler_kernel<streamed_scene>(streamed_world->has_lights());
+        }
+        if (compiled_scene != nullptr) {
+            return select_sampler_kernel<closed_scene>(scene_has_lights);
+        }
+        return select_sampler_kernel<virtual_scene>(scene_has_lights);
+    }
+
+    template <class scene_t>
+    tile_kernel select_sampler_kernel(bool scene_has_lights) const {
+        switch (sampling) {
+            case sampler_type::stratified: return select_flag_kernel<scene_t, stratified_sampler>(scene_has_lights);
+            case sampler_type::sobol:      return select_flag_kernel<scene_t, sobol_sampler>(scene_has_lights);
+            case sampler_type::halton:     return select_flag_kernel<scene_t, halton_sampler>(scene_has_lights);
+            default:                       return select_flag_kernel<scene_t, random_sampler>(scene_has_lights);
+        }
+    }
+
+    template <class scene_t, class sampler_t>
+    tile_kernel select_flag_kernel(bool scene_has_lights) const {
+        bool depth_of_field = defocus_angle > 0;
+        bool sample_lights = next_event_estimation && scene_has_lights;
+
+        if (heatmap) {
+            return depth_of_field ? &camera::render_heatmap_tile<scene_t, sampler_t, true>
+                                  : &camera::render_heatmap_tile<scene_t, sampler_t, false>;
+        }
+
+        if (sort_secondary_rays) {
+            if (depth_of_field) {
+                return sample_lights ? &camera::render_sorted_tile<scene_t, sampler_t, true, true>
+                                     : &camera::render_sorted_tile<scene_t, sampler_t, true, false>;
+            }
+            return sample_lights ? &camera::render_sorted_tile<scene_t, sampler_t, false, true>
+                                 : &camera::render_sorted_tile<scene_t, sampler_t, false, false>;
+        }
+
+        if (depth_of_field) {
+            return sample_lights ? &camera::render_tile<scene_t, sampler_t, true, true>
+                                 : &camera::render_tile<scene_t, sampler_t, true, false>;
+        }
+        return sample_lights ? &camera::render_tile<scene_t, sampler_t, false, true>
+                             : &camera::render_tile<scene_t, sampler_t, false, false>;
+    }
+
+    void prepare_scene(const hittable_list* world) {
+        // runs once per render, before any child forks
+        // closed world mode -- flatten the scene into tagged records
+        compiled_scene = nullptr;
+        if (closed_world && streamed_world == nullptr) {
+            compile_closed_scene(world);
+        }
+
+        // then pick the render kernel for this combination of settings
+        render_tile_kernel = select_render_kernel(world->has_lights());
+
+        prepare_hit_cache();
+        shared_texture_cache().set_budget(size_t(std::max(1, texture_cache_mb)) * 1024 * 1024);
+
+        if (pin_workers || numa_replicate) {
+            topology = cpu_topology::discover();
+            topology.print(std::cout);
+            if (!pinning_supported()) {
+                std::cerr << "Warning: thread pinning is not supported on this platform" << std::endl;
+            }
+            if (numa_replicate && compiled_scene == nullptr) {
+                // the open world is a graph of shared_ptrs -- there is no flat copy to replicate
+                std::cerr << "Warning: numa replication needs closed world mode" << std::endl;
+            }
+        }
+    }
+
+    void prepare_hit_cache() {
+        primary_hits = nullptr;
+        replay_primary_hits = false;
+        if (hit_cache_file.empty()) {
+            return;
+        }
+        if (compiled_scene == nullptr) {
+            // hits are stored as primitive + material ids, which only the closed world has
+            std::cerr << "Warning: the hit cache needs closed world mode -- not using it" << std::endl;
+            return;
+        }
+        if (sampling == sampler_type::random) {
+            // replay regenerates each camera ray from its (pixel, sample) -- the random sampler's
+            // numbers depend on which tiles a worker rendered before, so the rays would not match
+            std::cerr << "Warning: the hit cache needs a deterministic sampler (not random) -- not using it" << std::endl;
+            return;
+        }
+
+        shared_ptr<hit_cache> cache = make_shared<hit_cache>(width, height, samples_per_pixel, camera_key(), compiled_scene->geometry_hash());
+        if (!cache->valid()) {
+            return;
+        }
+
+        primary_hits = cache;
+        replay_primary_hits = cache->load(hit_cache_file);
+        std::cout << (replay_primary_hits ? "Hit cache: replaying " : "Hit cache: recording ") << hit_cache_file << std::endl;
+    }
+
+    uint64_t camera_key() const {
+        // everything that decides the camera rays of every pixel sample
+        double values[] = {
+            aspect_ratio, double(width), double(samples_per_pixel), double(int(sampling)), vfov,
+            lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+            vup.x(), vup.y(), vup.z(), defocus_angle, focus_dist, double(sampler_seed)
+        };
+        return hash_bytes(values, sizeof(values));
+    }
+
+    void compile_closed_scene(const hittable_list* world) {
+        shared_ptr<closed_scene> scene = make_shared<closed_scene>();
+        if (scene->compile(*world)) {
+            compiled_scene = scene;
+        } else {
+            std::cerr << "Warning: scene cannot run in closed world mode -- using virtual dispatch" << std::endl;
+        }
+    }
+
+    bool save_hit_cache() const {
+        // the camera ray hits this render recorded, if it recorded any -- false if there was nothing to save
+        if (primary_hits == nullptr || replay_primary_hits) {
+            return false;
+        }
+        if (!primary_hits->complete()) {
+            // a deadline render, remote workers or a strip
+            std::cerr << "Warning: hit cache not saved -- this render did not trace every sample" << std::endl;
+            return false;
+        }
+        return primary_hits->save(hit_cache_file);
+    }
+
+    void write_outputs(const framebuffer& fb, const std::string& base_path, bool beauty_written = false) const {
+        // beauty image + aov buffers + denoised image, depending on the camera settings
+        // (+ the hit cache, if this render recorded one)
+        // beauty_written -- the beauty image was already encoded while rendering
+        if (heatmap) {
+            // the color buffer holds traversal counts, not radiance
+            write_heatmaps(base_path + "-heatmap", fb);
+            return;
+        }
+
+        if (!beauty_written) {
+            if (output_format == image_format::ppm) {
+                write_ppm(base_path + ".ppm", fb.color_data(), fb.width(), fb.height());
+            } else {
+                write_image(base_path + image_format_extension(output_format), fb.color_data(), fb.width(), fb.height(), output_format);
+            }
+        }
+
+        if (streamed_world != nullptr) {
+            streamed_world->print_statistics(std::cout);
+        }
+        shared_texture_cache().print_statistics(std::cout);
+
+        save_hit_cache();
+
+        if (output_aovs) {
+            write_aovs(base_path, fb);
+        }
+
+        if (denoise) {
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+            std::vector<float> denoised;
+            denoise_settings.run(fb, denoised);
+            write_ppm(base_path + "-denoised.ppm", denoised.data(), fb.width(), fb.height());
+
+            std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+            std::cout << "Denoise time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << " ms" << std::endl;
         }
     }
 
     // getters + setters
     int get_height() { return height; }
 
+    bool replaying_hit_cache() const { return replay_primary_hits; }
+
     point3 get_center() { return center; }
 
 };
@@ -0,0 +1,633 @@
+
+
+#ifndef closed_scene_h
+#define closed_scene_h
+
+#include "utils/common.h"
+#include "math/transform.h"
+
+#include "physics/hittable.h"
+#include "physics/hittable_list.h"
+#include "physics/material.h"
+#include "physics/sphere.h"
+#include "physics/plane.h"
+#include "physics/instance.h"
+
+#include <map>
+
+
+// ----------------------------------------------------- //
+// closed world records
+// ----------------------------------------------------- //
+// every primitive + material the renderer knows about, stored as a small tagged record
+// dispatch is a switch on the tag instead of a virtual call, so the compiler can inline the
+// whole intersection + scatter path
+
+enum class primitive_kind { sphere, plane, quad, disk, instance };
+enum class material_kind { lambertian, metal, dielectric, diffuse_light };
+
+struct closed_primitive {
+    primitive_kind kind;
+    int material;               // sphere, plane, quad, disk -- index into closed_scene::materials
+    int instance;               // instance -- index into closed_scene::instances
+    point3 center;              // quad -- the corner, plane -- any point on it
+    double radius;              // sphere, disk
+    vec3 normal;                // plane, disk
+    vec3 u, v;                  // quad -- edges
+};
+
+struct closed_material {
+    material_kind kind;
+    int texture;                // lambertian, metal -- -1: the constant albedo, else index into closed_material_table::textures
+    color albedo;               // lambertian, metal
+    double fuzz;                // metal
+    double refraction_index;    // dielectric
+    color emit;                 // diffuse_light
+};
+
+struct closed_instance {
+    transform object_to_world;
+    transform world_to_object;
+    int bvh;                    // index into closed_scene::bvhs -- shared by every instance of the object
+};
+
+struct closed_node {
+    aabb bounding_box;
+    int left, right;            // child node indices (interior nodes)
+    int first, count;           // range in closed_bvh::primitives (leaves -- count >= 0)
+};
+
+struct closed_bvh {
+    std::vector<closed_node> nodes;
+    std::vector<int> primitives;
+    std::vector<int> unbounded;         // hittable_list::unbounded -- tested before the nodes
+};
+
+
+// ----------------------------------------------------- //
+// closed_material_table
+// ----------------------------------------------------- //
+// material half of the scene interface camera::ray_color uses -- switch dispatch on the
+// material record a hit_record's material_id points at
+// shared by closed_scene and streamed_scene
+
+class closed_material_table {
+protected:
+    std::vector<closed_material> materials;
+    std::vector<shared_ptr<texture>> textures;
+
+public:
+    bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const {
+        const closed_material& m = materials[rec.material_id];
+        switch (m.kind) {
+            case material_kind::lambertian: return lambertian::sample(albedo_of(m, rec), rec, u, attenuation, scattered);
+            case material_kind::metal:      return metal::sample(albedo_of(m, rec), m.fuzz, r_in, rec, u, attenuation, scattered);
+            case material_kind::dielectric: return dielectric::sample(m.refraction_index, r_in, rec, u, attenuation, scattered);
+            default:                        return false;
+        }
+    }
+
+    color emitted(const ray& r_in, const hit_record& rec) const {
+        const closed_material& m = materials[rec.material_id];
+        return m.kind == material_kind::diffuse_light ? diffuse_light::emission(m.emit, rec) : color(0, 0, 0);
+    }
+
+    color albedo_value(const hit_record& rec) const {
+        const closed_material& m = materials[rec.material_id];
+        return (m.kind == material_kind::lambertian || m.kind == material_kind::metal) ? albedo_of(m, rec) : color(1, 1, 1);
+    }
+
+    bool is_diffuse(const hit_record& rec) const {
+        return materials[rec.material_id].kind == material_kind::lambertian;
+    }
+
+    color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+        const closed_material& m = materials[rec.material_id];
+        return m.kind == material_kind::lambertian ? lambertian::evaluate(albedo_of(m, rec), rec, direction) : color(0, 0, 0);
+    }
+
+    double scatter_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+        return materials[rec.material_id].kind == material_kind::lambertian ? lambertian::pdf(rec, direction) : 0;
+    }
+
+    // false for materials the closed world does not know about -- textured materials add their
+    // texture to `textures`, or are refused if it is null
+    static bool describe(const material* mat, closed_material& m, std::vector<shared_ptr<texture>>* textures = nullptr) {
+        shared_ptr<texture> tex;
+        m.texture = -1;
+        m.albedo = color(0, 0, 0);
+        m.fuzz = 0;
+        m.refraction_index = 1;
+        m.emit = color(0, 0, 0);
+
+        if (const lambertian* l = dynamic_cast<const lambertian*>(mat)) {
+            m.kind = material_kind::lambertian;
+            m.albedo = l->get_albedo();
+            tex = l->get_texture();
+        } else if (const metal* me = dynamic_cast<const metal*>(mat)) {
+            m.kind = material_kind::metal;
+            m.albedo = me->get_albedo();
+            m.fuzz = me->get_fuzz();
+            tex = me->get_texture();
+        } else if (const dielectric* d = dynamic_cast<const dielectric*>(mat)) {
+            m.kind = material_kind::dielectric;
+            m.refraction_index = d->get_refraction_index();
+        } else if (const diffuse_light* e = dynamic_cast<const diffuse_light*>(mat)) {
+            m.kind = material_kind::diffuse_light;
+            m.emit = e->get_emit();
+        } else {
+            return false;
+        }
+
+        if (tex) {
+            if (textures == nullptr) {
+                return false;
+            }
+            m.texture = int(textures->size());
+            textures->push_back(tex);
+        }
+        return true;
+    }
+
+    size_t material_count() const { return materials.size(); }
+
+private:
+    color albedo_of(const closed_material& m, const hit_record& rec) const {
+        return m.texture < 0 ? m.albedo : textures[m.texture]->value(rec);
+    }
+};
+
+
+// ----------------------------------------------------- //
+// closed_scene
+// ----------------------------------------------------- //
+// flattened copy of a finalized hittable_list + the bvh_node trees it built
+// compile() fails (returns false) if the scene holds a type it does not know about -- the
+// camera then keeps using the virtual path
+
+class closed_scene : public closed_material_table {
+private:
+    static const int max_stack = 64;
+
+    std::vector<closed_primitive> primitives;
+    std::vector<closed_instance> instances;
+    std::vector<closed_bvh> bvhs;
+    std::vector<int> lights;            // sphere primitives that are sampled directly
+    int root_bvh;
+
+    std::map<const hittable*, int> primitive_ids;
+    std::map<const hittable*, int> bvh_ids;
+    std::map<const material*, int> material_ids;
+
+public:
+    closed_scene(): root_bvh(-1) {}
+
+    bool compile(const hittable_list& world) {
+        primitives.clear();
+        materials.clear();
+        instances.clear();
+        bvhs.clear();
+        lights.clear();
+        primitive_ids.clear();
+        bvh_ids.clear();
+        material_ids.clear();
+
+        root_bvh = compile_list(world);
+        if (root_bvh < 0) {
+            return false;
+        }
+
+        for (const auto& light : world.lights) {
+            auto found = primitive_ids.find(light.get());
+            if (found == primitive_ids.end() || primitives[found->second].kind != primitive_kind::sphere) {
+                std::cerr << "Error: closed world mode only supports sphere lights" << std::endl;
+                return false;
+            }
+            lights.push_back(found->second);
+        }
+
+        std::cout << "Closed world: " << primitives.size() << " primitives, " << materials.size() << " materials, "
+                  << instances.size() << " instances, " << bvhs.size() << " bvhs" << std::endl;
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        return hit_bvh(root_bvh, r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        return occluded_bvh(root_bvh, r, ray_t);
+    }
+
+    // ----------------------------------------------------- //
+    // lights
+    // ----------------------------------------------------- //
+
+    bool has_lights() const {
+        return !lights.empty();
+    }
+
+    double light_pdf_value(const point3& origin, const vec3& direction) const {
+        double sum = 0.0;
+        for (int id : lights) {
+            sum += sphere::cone_pdf(primitives[id].center, primitives[id].radius, origin, direction);
+        }
+        return sum / lights.size();
+    }
+
+    vec3 sample_light(const point3& origin, const vec3& u) const {
+        int index = std::min(int(u.z() * lights.size()), int(lights.size()) - 1);
+        const closed_primitive& light = primitives[lights[index]];
+        return sphere::cone_sample(light.center, light.radius, origin, u.x(), u.y());
+    }
+
+    bool hit_lights(const ray& r, interval ray_t, hit_record& rec) const {
+        bool hit_anything = false;
+        for (int id : lights) {
+            if (hit_primitive(id, r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    // ----------------------------------------------------- //
+    // identity
+    // ----------------------------------------------------- //
+
+    // fnv-1a over everything that decides where rays hit -- materials are left out on purpose,
+    // so a cache of primary hits stays valid while materials are edited
+    uint64_t geometry_hash() const {
+        uint64_t hash = hash_bytes(nullptr, 0);
+        auto mix = [&hash](const void* data, size_t size) { hash = hash_bytes(data, size, hash); };
+
+        for (const closed_primitive& p : primitives) {
+            mix(&p.kind, sizeof(p.kind));
+            mix(&p.instance, sizeof(p.instance));
+            mix(&p.center, sizeof(p.center));
+            mix(&p.radius, sizeof(p.radius));
+            mix(&p.normal, sizeof(p.normal));
+            mix(&p.u, sizeof(p.u));
+            mix(&p.v, sizeof(p.v));
+        }
+        for (const closed_instance& inst : instances) {
+            mix(&inst.object_to_world, sizeof(inst.object_to_world));
+            mix(&inst.bvh, sizeof(inst.bvh));
+        }
+        for (const closed_bvh& bvh : bvhs) {
+            mix(bvh.primitives.data(), bvh.primitives.size() * sizeof(int));
+            mix(bvh.unbounded.data(), bvh.unbounded.size() * sizeof(int));
+        }
+        return hash;
+    }
+
+    // the material a primitive is shaded with now -- what a replayed hit cache entry gets
+    int primitive_material(int64_t id) const {
+        return primitives[size_t(id)].material;
+    }
+
+private:
+    // ----------------------------------------------------- //
+    // traversal
+    // ----------------------------------------------------- //
+
+    bool hit_bvh(int bvh_index, const ray& r, interval ray_t, hit_record& rec) const {
+        // nearest primitive first, then its hit_record -- only the winner pays for the attributes
+        double t;
+        int id;
+        if (!nearest_in_bvh(bvh_index, r, ray_t, t, id)) {
+            return false;
+        }
+        fill_primitive(id, r, ray_t, t, rec);
+        return true;
+    }
+
+    bool nearest_in_bvh(int bvh_index, const ray& r, interval ray_t, double& t, int& id) const {
+        const closed_bvh& bvh = bvhs[bvh_index];
+
+        // same visiting rules as bvh_node::get_intersecting_nodes, without the per ray vectors
+        int stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+
+        double candidate_t;
+        TRAVERSAL_COUNTERS.primitives += bvh.unbounded.size();
+        for (int candidate : bvh.unbounded) {
+            if (nearest_primitive(candidate, r, interval(ray_t.min, closest_so_far), candidate_t)) {
+                hit_anything = true;
+                closest_so_far = candidate_t;
+                id = candidate;
+            }
+        }
+
+        while (top > 0) {
+            const closed_node& node = bvh.nodes[stack[--top]];
+
+            if (node.count >= 0) {
+                TRAVERSAL_COUNTERS.primitives += node.count;
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    if (nearest_primitive(bvh.primitives[i], r, interval(ray_t.min, closest_so_far), candidate_t)) {
+                        hit_anything = true;
+                        closest_so_far = candidate_t;
+                        id = bvh.primitives[i];
+                    }
+                }
+                continue;
+            }
+
+            // nodes entirely behind the closest hit so far are skipped
+            interval remaining(ray_t.min, closest_so_far);
+            TRAVERSAL_COUNTERS.nodes += 2;
+            if (bvh.nodes[node.right].bounding_box.intersect(r, remaining)) stack[top++] = node.right;
+            if (bvh.nodes[node.left].bounding_box.intersect(r, remaining)) stack[top++] = node.left;
+        }
+
+        t = closest_so_far;
+        return hit_anything;
+    }
+
+    bool occluded_bvh(int bvh_index, const ray& r, interval ray_t) const {
+        // any hit -- no closest_so_far to shrink, so the visiting order does not matter
+        const closed_bvh& bvh = bvhs[bvh_index];
+
+        for (int id : bvh.unbounded) {
+            TRAVERSAL_COUNTERS.primitives++;
+            if (occluded_primitive(id, r, ray_t)) return true;
+        }
+
+        int stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const closed_node& node = bvh.nodes[stack[--top]];
+
+            if (node.count >= 0) {
+                for (int i = node.first; i < node.first + node.count; i++) {
+                    TRAVERSAL_COUNTERS.primitives++;
+                    if (occluded_primitive(bvh.primitives[i], r, ray_t)) return true;
+                }
+                continue;
+            }
+
+            TRAVERSAL_COUNTERS.nodes += 2;
+            if (bvh.nodes[node.right].bounding_box.intersect(r, ray_t)) stack[top++] = node.right;
+            if (bvh.nodes[node.left].bounding_box.intersect(r, ray_t)) stack[top++] = node.left;
+        }
+
+        return false;
+    }
+
+    bool occluded_primitive(int id, const ray& r, interval ray_t) const {
+        // instances stop at their first inner hit, everything else is a single distance test
+        const closed_primitive& p = primitives[id];
+        if (p.kind == primitive_kind::instance) {
+            const closed_instance& inst = instances[p.instance];
+            ray local(inst.world_to_object.apply_point(r.origin()), inst.world_to_object.apply_vector(r.direction()));
+            return occluded_bvh(inst.bvh, local, ray_t);
+        }
+
+        double t;
+        return nearest_primitive(id, r, ray_t, t);
+    }
+
+    bool hit_primitive(int id, const ray& r, interval ray_t, hit_record& rec) const {
+        double t;
+        if (!nearest_primitive(id, r, ray_t, t)) {
+            return false;
+        }
+        fill_primitive(id, r, ray_t, t, rec);
+        return true;
+    }
+
+    bool nearest_primitive(int id, const ray& r, interval ray_t, double& t) const {
+        // distance only -- sets t if the primitive is hit inside ray_t
+        const closed_primitive& p = primitives[id];
+        switch (p.kind) {
+            case primitive_kind::sphere: return sphere::intersect(p.center, p.radius, r, ray_t, t);
+            case primitive_kind::plane:  return plane::intersect(p.center, p.normal, r, ray_t, t);
+            case primitive_kind::disk:   return disk::intersect(p.center, p.normal, p.radius, r, ray_t, t);
+            case primitive_kind::quad:   return quad::intersect(p.center, p.u, p.v, r, ray_t, t);
+            case primitive_kind::instance: {
+                const closed_instance& inst = instances[p.instance];
+                ray local(inst.world_to_object.apply_point(r.origin()), inst.world_to_object.apply_vector(r.direction()));
+                int inner;
+                return nearest_in_bvh(inst.bvh, local, ray_t, t, inner);
+            }
+        }
+        return false;
+    }
+
+    void fill_primitive(int id, const ray& r, interval ray_t, double t, hit_record& rec) const {
+        // hit_record of the winner of nearest_primitive, hit at t
+        const closed_primitive& p = primitives[id];
+        switch (p.kind) {
+            case primitive_kind::sphere:
+                sphere::fill_hit_record(p.center, p.radius, r, t, rec);
+                break;
+            case primitive_kind::plane:
+                plane::fill_hit_record(p.center, p.normal, r, t, rec);
+                break;
+            case primitive_kind::disk:
+                disk::fill_hit_record(p.center, p.normal, p.radius, r, t, rec);
+                break;
+            case primitive_kind::quad:
+                quad::fill_hit_record(p.center, p.u, p.v, r, t, rec);
+                break;
+            case primitive_kind::instance: {
+                // same math as instance::hit -- the inner winner is found again, up to just past t
+                // (same ray, same arithmetic, same root)
+                const closed_instance& inst = instances[p.instance];
+                ray local(inst.world_to_object.apply_point(r.origin()), inst.world_to_object.apply_vector(r.direction()));
+                hit_bvh(inst.bvh, local, interval(ray_t.min, std::nextafter(t, infinity)), rec);
+                rec.p = inst.object_to_world.apply_point(rec.p);
+                rec.normal = unit_vector(inst.world_to_object.apply_transposed(rec.normal));
+                return;
+            }
+        }
+        rec.material_id = p.material;
+        rec.primitive_id = id;
+    }
+
+    // ----------------------------------------------------- //
+    // compilation
+    // ----------------------------------------------------- //
+
+    int compile_list(const hittable_list& list) {
+        auto found = bvh_ids.find(&list);
+        if (found != bvh_ids.end()) {
+            return found->second;
+        }
+        if (!list._finalized) {
+            std::cerr << "Error: closed world needs finalized hittable_lists" << std::endl;
+            return -1;
+        }
+
+        closed_bvh bvh;
+        bool ok = true;
+        if (list.bvh.max_depth() == 0) {
+            // no bvh tree -- one leaf with every object
+            ok = add_leaf(bvh, *list.objects, list.bounding_box);
+        } else {
+            ok = flatten(bvh, list.bvh.get_root(), 0) >= 0;
+            for (const auto& object : list.unbounded) {
+                int id = ok ? compile_object(object.get()) : -1;
+                ok = id >= 0;
+                bvh.unbounded.push_back(id);
+            }
+        }
+        if (!ok) {
+            return -1;
+        }
+
+        int id = int(bvhs.size());
+        bvhs.push_back(bvh);
+        bvh_ids[&list] = id;
+        return id;
+    }
+
+    int flatten(closed_bvh& bvh, const shared_ptr<bvh_node>& node, int depth) {
+        if (depth >= max_stack - 1) {
+            std::cerr << "Error: bvh too deep for closed world traversal" << std::endl;
+            return -1;
+        }
+
+        // the flat copy needs every node -- lazy trees are built out completely here
+        node->expand();
+        if (node->is_leaf_node() || node->get_children().size() != 2) {
+            int id = int(bvh.nodes.size());
+            return add_leaf(bvh, *node->get_relevant_objects(), node->bounding_box) ? id : -1;
+        }
+
+        int id = int(bvh.nodes.size());
+        closed_node interior;
+        interior.bounding_box = node->bounding_box;
+        interior.first = 0;
+        interior.count = -1;
+        bvh.nodes.push_back(interior);
+
+        int left = flatten(bvh, node->get_children()[0], depth + 1);
+        int right = flatten(bvh, node->get_children()[1], depth + 1);
+        if (left < 0 || right < 0) {
+            return -1;
+        }
+        bvh.nodes[id].left = left;
+        bvh.nodes[id].right = right;
+        return id;
+    }
+
+    bool add_leaf(closed_bvh& bvh, const std::vector<shared_ptr<hittable>>& objects, const aabb& box) {
+        closed_node leaf;
+        leaf.bounding_box = box;
+        leaf.left = leaf.right = -1;
+        leaf.first = int(bvh.primitives.size());
+        leaf.count = int(objects.size());
+        bvh.nodes.push_back(leaf);
+
+        for (const auto& object : objects) {
+            int id = compile_object(object.get());
+            if (id < 0) {
+                return false;
+            }
+            bvh.primitives.push_back(id);
+        }
+        return true;
+    }
+
+    int compile_object(const hittable* object) {
+        auto found = primitive_ids.find(object);
+        if (found != primitive_ids.end()) {
+            return found->second;
+        }
+
+        closed_primitive p;
+        p.material = -1;
+        p.instance = -1;
+        p.radius = 0;
+
+        if (const sphere* s = dynamic_cast<const sphere*>(object)) {
+            p.kind = primitive_kind::sphere;
+            p.center = s->get_center();
+            p.radius = s->get_radius();
+            p.material = compile_material(s->get_material().get());
+            if (p.material < 0) return -1;
+        } else if (const plane* pl = dynamic_cast<const plane*>(object)) {
+            p.kind = primitive_kind::plane;
+            p.center = pl->get_point();
+            p.normal = pl->get_normal();
+            p.material = compile_material(pl->get_material().get());
+            if (p.material < 0) return -1;
+        } else if (const quad* q = dynamic_cast<const quad*>(object)) {
+            p.kind = primitive_kind::quad;
+            p.center = q->get_corner();
+            p.u = q->get_u();
+            p.v = q->get_v();
+            p.material = compile_material(q->get_material().get());
+            if (p.material < 0) return -1;
+        } else if (const disk* d = dynamic_cast<const disk*>(object)) {
+            p.kind = primitive_kind::disk;
+            p.center = d->get_center();
+            p.normal = d->get_normal();
+            p.radius = d->get_radius();
+            p.material = compile_material(d->get_material().get());
+            if (p.material < 0) return -1;
+        } else if (const instance* inst = dynamic_cast<const instance*>(object)) {
+            const hittable_list* list = dynamic_cast<const hittable_list*>(inst->get_object().get());
+            if (list == nullptr) {
+                std::cerr << "Error: closed world instances must reference a hittable_list" << std::endl;
+                return -1;
+            }
+            closed_instance record;
+            record.object_to_world = inst->get_transform();
+            record.world_to_object = inst->get_inverse_transform();
+            record.bvh = compile_list(*list);
+            if (record.bvh < 0) return -1;
+
+            p.kind = primitive_kind::instance;
+            p.instance = int(instances.size());
+            instances.push_back(record);
+        } else if (const hittable_list* list = dynamic_cast<const hittable_list*>(object)) {
+            // nested list -- an instance with the identity transform
+            closed_instance record;
+            record.bvh = compile_list(*list);
+            if (record.bvh < 0) return -1;
+
+            p.kind = primitive_kind::instance;
+            p.instance = int(instances.size());
+            instances.push_back(record);
+        } else {
+            std::cerr << "Error: closed world does not support hittable " << object->get_uuid() << std::endl;
+            return -1;
+        }
+
+        int id = int(primitives.size());
+        primitives.push_back(p);
+        primitive_ids[object] = id;
+        return id;
+    }
+
+    int compile_material(const material* mat) {
+        auto found = material_ids.find(mat);
+        if (found != material_ids.end()) {
+            return found->second;
+        }
+
+        closed_material m;
+        if (!describe(mat, m, &textures)) {
+            std::cerr << "Error: closed world does not support this material" << std::endl;
+            return -1;
+        }
+
+        int id = int(materials.size());
+        materials.push_back(m);
+        material_ids[mat] = id;
+        return id;
+    }
+};
+
+
+#endif
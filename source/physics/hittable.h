@@ -6,18 +6,41 @@
 
 #include "utils/common.h"
 
+#include <cstdint>
+
 class material;
 
 int OBJECT_COUNTER = 0;
 
+// bounding boxes + primitives tested by this thread -- bumped by every scene traversal, read
+// (and reset) per camera sample by the camera's heatmap mode
+// rays -- camera, bounce + shadow rays the path tracer traced (never reset, read per tile)
+struct traversal_counters {
+    uint64_t nodes = 0;
+    uint64_t primitives = 0;
+    uint64_t rays = 0;
+};
+
+thread_local traversal_counters TRAVERSAL_COUNTERS;
+
 class hit_record {
 public:
     point3 p;
     vec3 normal;
     shared_ptr<material> mat;
+    int material_id = -1;           // closed world mode only -- index into closed_scene::materials
+    int64_t primitive_id = -1;      // closed world + streamed scenes -- index of the primitive that was hit
+                                    // (64 bit: a streamed scene can hold more than 2^31 spheres)
     double t;
     bool front_face;
 
+    // texturing -- (u, v) are surface coordinates, du / dv the world space length of one unit of
+    // u / v around p, footprint the world space width of the ray's pixel footprint at p (set by
+    // the camera from its ray cone). du / dv / footprint of 0 mean unknown -- finest mip level
+    double u = 0, v = 0;
+    double du = 0, dv = 0;
+    double footprint = 0;
+
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // sets the hit record normal vector -- tracking for hitting the "outer" surface of an object
         // NOTE: the paramterer `outward_normal` is assumed to have unit length
@@ -27,6 +50,15 @@ public:
     }
 };
 
+class hittable;
+
+// the nearest hit of a query so far, before any of its attributes are computed -- traversal only
+// keeps the distance + which object it was, and the winner fills the hit_record once at the end
+struct hit_candidate {
+    double t;
+    const hittable* object = nullptr;
+};
+
 class hittable {
 private:
     // private members
@@ -39,6 +71,46 @@ public:
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
     virtual void calculate_bounding_box() = 0;
 
+    // two phase closest hit: hit_distance only finds the nearest t in ray_t (+ sets `nearest`
+    // when it does), fill_hit then computes the point / normal / material of that winner.
+    // the defaults go through hit() -- fill_hit re-runs it up to just past the winner's t, which
+    // lands on the same root, so objects with a nested search (instance) can keep them
+    virtual bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const {
+        hit_record rec;
+        if (!hit(r, ray_t, rec)) {
+            return false;
+        }
+        nearest.t = rec.t;
+        nearest.object = this;
+        return true;
+    }
+    virtual void fill_hit(const ray& r, interval ray_t, const hit_candidate& nearest, hit_record& rec) const {
+        hit(r, interval(ray_t.min, std::nextafter(nearest.t, infinity)), rec);
+    }
+
+    // any hit inside ray_t -- for shadow / visibility rays. stops at the first hit it finds and
+    // fills no hit_record, so primitives should override it with their bare intersection test
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // true for objects without a finite bounding box (planes) -- hittable_list tests these
+    // before the bvh instead of putting them in it
+    virtual bool is_unbounded() const {
+        return false;
+    }
+
+    // light sampling -- only objects that can be used as lights need to override these
+    // pdf_value: solid angle pdf of `random` generating `direction` from `origin`
+    // random: direction from `origin` towards a random point on the object -- (u1, u2) are uniform
+    virtual double pdf_value(const point3& origin, const vec3& direction) const {
+        return 0.0;
+    }
+    virtual vec3 random(const point3& origin, double u1, double u2) const {
+        return vec3(1, 0, 0);
+    }
+
     void initialize_base_objects() {
         // TODO : implement this function
         // generate a unique id for the object
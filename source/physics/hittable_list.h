@@ -13,37 +13,75 @@ using std::shared_ptr;
 class hittable_list : public hittable {
 public:
     shared_ptr<std::vector<shared_ptr<hittable>>> objects;
+    std::vector<shared_ptr<hittable>> lights;       // subset of objects sampled by next event estimation
+    std::vector<shared_ptr<hittable>> unbounded;    // subset of objects kept out of the bvh -- see finalize
     bvh_container bvh;
     bool _finalized;
 
+    // objects whose bounding box diagonal is this many times the median are treated as unbounded
+    double oversized_factor = 100.0;
+
+    // finalize leaves the bvh unsplit -- every node is split by the first ray that reaches it, so
+    // the build cost follows the visible part of the scene and rendering starts right away
+    bool lazy_bvh = false;
+
     hittable_list(): _finalized(false) {
         objects = make_shared<std::vector<shared_ptr<hittable>>>();
     }
-    hittable_list(shared_ptr<hittable> object) {
+    hittable_list(shared_ptr<hittable> object): _finalized(false) {
         objects = make_shared<std::vector<shared_ptr<hittable>>>();
         add(object);
     }
 
     void clear() {
         objects->clear();
+        lights.clear();
+        unbounded.clear();
     }
 
     void add(shared_ptr<hittable> object) {
         objects->push_back(object);
     }
 
+    void add_light(shared_ptr<hittable> object) {
+        // NOTE: lights must be top level objects -- lights inside an instance are not sampled
+        objects->push_back(object);
+        lights.push_back(object);
+    }
+
     void finalize(point3 cam_position, int bvh_depth) {
         calculate_bounding_box();
+
+        // planes + huge objects (a radius 1000 ground sphere) overlap every split, so every ray
+        // would test them in every leaf -- keep them in a flat list the bvh never sees
+        auto bounded = make_shared<std::vector<shared_ptr<hittable>>>();
+        partition_unbounded(*bounded);
+
         // create bvh tree
-        bvh = bvh_container(objects, bvh_depth, cam_position);
+        bvh = bvh_container(bounded, bvh_depth, cam_position, lazy_bvh);
         _finalized = true;
 
         // output bounding box
         std::cout << "Bounding box: " << bounding_box.min() << ", " << bounding_box.max() << std::endl;
-        std::cout << "Number of objects: " << objects->size() << std::endl;
+        std::cout << "Number of objects: " << objects->size() << " (" << unbounded.size() << " outside the bvh)" << std::endl;
+    }
+
+    void finalize(int bvh_depth) {
+        // for sub-scenes that are only ever seen through an instance -- no camera to sort against
+        finalize(point3(0, 0, 0), bvh_depth);
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // nearest object first, then its hit_record -- see hit_distance
+        hit_candidate nearest;
+        if (!hit_distance(r, ray_t, nearest)) {
+            return false;
+        }
+        nearest.object->fill_hit(r, ray_t, nearest, rec);
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
         if (!_finalized) {
             std::cerr << "Error: hittable_list not finalized. Call finalize() before using." << std::endl;
             return false;
@@ -53,9 +91,11 @@ public:
         // goal here: use the bvh to do 2 things
         // 1. determine leaf nodes that interesect with ray
         // 2. check if any of the objects in the leaf nodes intersect with the ray
+        // only the distance + object of the closest hit are kept -- the caller fills the
+        // hit_record of the winner (fill_hit) instead of every closer candidate copying one
         
         // keep track of all collisions with these variables
-        hit_record temp_rec, temp_node_rec;
+        hit_record temp_node_rec;
         temp_node_rec.t = 1e9;          // use t as a distance variable
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
@@ -63,12 +103,12 @@ public:
         if (bvh.max_depth() == 0) {
             // no bvh tree, just check all objects
             // iterate through all relevant objects in the node 
-            for(auto object : *objects){
-                if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            for(const auto& object : *objects){
+                TRAVERSAL_COUNTERS.primitives++;
+                if (object->hit_distance(r, interval(ray_t.min, closest_so_far), nearest)) {
                     // update data for closest valid collision so far
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec;
+                    closest_so_far = nearest.t;
                 }
 
             }
@@ -76,29 +116,29 @@ public:
         }
 
 
-        // find intersecting leaf nodes
-        std::vector<shared_ptr<bvh_node>> leaf_nodes = bvh.get_intersecting_nodes(r, ray_t, temp_node_rec);
-
-        // output # of nodes to check
-        int total_size = 0;
-        for (int i = 0; i < leaf_nodes.size(); i++) {
-            total_size += leaf_nodes[i]->get_relevant_objects()->size();
-
-            // std::cout << "Node " << i << ": " << leaf_nodes[i]->bounding_box << std::endl;
+        // unbounded objects first -- their closest hit shortens the ray, which culls every bvh
+        // node behind it (the ground hides most of the scene below the horizon)
+        for (const auto& object : unbounded) {
+            TRAVERSAL_COUNTERS.primitives++;
+            if (object->hit_distance(r, interval(ray_t.min, closest_so_far), nearest)) {
+                hit_anything = true;
+                closest_so_far = nearest.t;
+            }
         }
-        // std::cout << "# of nodes: " << leaf_nodes.size() << " | # of objects: " << total_size << std::endl;
+
+        // find intersecting leaf nodes
+        std::vector<shared_ptr<bvh_node>> leaf_nodes = bvh.get_intersecting_nodes(r, interval(ray_t.min, closest_so_far), temp_node_rec);
 
         // iterate through all nodes and children in nodes
-        shared_ptr<hittable> object;
-        for(shared_ptr<bvh_node> node : leaf_nodes) {
+        for(const shared_ptr<bvh_node>& node : leaf_nodes) {
 
             // iterate through all relevant objects in the node 
-            for(auto object : *(node->get_relevant_objects())){
-                if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            for(const auto& object : *(node->get_relevant_objects())){
+                TRAVERSAL_COUNTERS.primitives++;
+                if (object->hit_distance(r, interval(ray_t.min, closest_so_far), nearest)) {
                     // update data for closest valid collision so far
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec;
+                    closest_so_far = nearest.t;
                 }
 
             }
@@ -109,6 +149,86 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (!_finalized) {
+            std::cerr << "Error: hittable_list not finalized. Call finalize() before using." << std::endl;
+            return false;
+        }
+
+        if (bvh.max_depth() == 0) {
+            return bvh_node::any_hit(*objects, r, ray_t);
+        }
+
+        // planes first -- the ground blocks most shadow rays that point below the horizon
+        return bvh_node::any_hit(unbounded, r, ray_t) || bvh.occluded(r, ray_t);
+    }
+
+    // ----------------------------------------------------- //
+    // light sampling
+    // ----------------------------------------------------- //
+
+    bool has_lights() const {
+        return !lights.empty();
+    }
+
+    double light_pdf_value(const point3& origin, const vec3& direction) const {
+        // lights are picked uniformly -- the pdf is the average of every light's pdf
+        double sum = 0.0;
+        for (const auto& light : lights) {
+            sum += light->pdf_value(origin, direction);
+        }
+        return sum / lights.size();
+    }
+
+    vec3 sample_light(const point3& origin, const vec3& u) const {
+        // u.z picks the light, (u.x, u.y) pick the point on it
+        int index = std::min(int(u.z() * lights.size()), int(lights.size()) - 1);
+        return lights[index]->random(origin, u.x(), u.y());
+    }
+
+    bool hit_lights(const ray& r, interval ray_t, hit_record& rec) const {
+        // closest hit among the lights only -- there are few, so no bvh
+        bool hit_anything = false;
+        for (const auto& light : lights) {
+            if (light->hit(r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    // splits objects into the unbounded list + the rest (returned in `bounded`)
+    void partition_unbounded(std::vector<shared_ptr<hittable>>& bounded) {
+        unbounded.clear();
+
+        // "huge" is relative to the typical object -- the median bounding box diagonal
+        std::vector<double> diagonals;
+        for (const auto& object : *objects) {
+            if (!object->is_unbounded()) {
+                diagonals.push_back(object->bounding_box.diagonal().length());
+            }
+        }
+
+        double limit = infinity;
+        if (diagonals.size() >= 8) {
+            // too few objects and the median means nothing -- only planes are split off
+            std::nth_element(diagonals.begin(), diagonals.begin() + diagonals.size() / 2, diagonals.end());
+            double median = diagonals[diagonals.size() / 2];
+            if (median > 0) {
+                limit = oversized_factor * median;
+            }
+        }
+
+        for (const auto& object : *objects) {
+            if (object->is_unbounded() || object->bounding_box.diagonal().length() > limit) {
+                unbounded.push_back(object);
+            } else {
+                bounded.push_back(object);
+            }
+        }
+    }
+
     void calculate_bounding_box() override {
         // TODO : implement this function
         vec3 min(1e9, 1e9, 1e9);
@@ -0,0 +1,83 @@
+
+
+#ifndef instance_h
+#define instance_h
+
+#include "utils/common.h"
+#include "math/transform.h"
+
+#include "physics/hittable.h"
+
+
+// ----------------------------------------------------- //
+// instance
+// ----------------------------------------------------- //
+// places a shared object (usually a finalized hittable_list with its own bvh)
+// into the world with a transform -- the object itself is never copied, so many
+// instances only cost a transform pair + a pointer each
+
+class instance : public hittable {
+private:
+    shared_ptr<hittable> object;
+    transform object_to_world;
+    transform world_to_object;
+
+public:
+    instance(shared_ptr<hittable> object, const transform& object_to_world)
+        : object(object), object_to_world(object_to_world), world_to_object(object_to_world.inverse()) {
+        // NOTE: a hittable_list must be finalized before it is instanced -- its bounding box
+        //       is only known after finalize()
+        initialize_base_objects();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // move the ray into object space
+        // the direction is NOT normalized, so `t` means the same thing in both spaces
+        ray local(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()));
+
+        if (!object->hit(local, ray_t, rec)) {
+            return false;
+        }
+
+        // move the hit back into world space
+        // normals use the inverse transpose -- dot(dir, normal) keeps its sign, so front_face stays valid
+        rec.p = object_to_world.apply_point(rec.p);
+        rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
+        // the winner is this instance -- fill_hit (the default) runs hit() once more to get the
+        // inner hit_record + transform it, instead of every closer candidate doing so
+        ray local(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()));
+
+        hit_candidate inner;
+        if (!object->hit_distance(local, ray_t, inner)) {
+            return false;
+        }
+        nearest.t = inner.t;
+        nearest.object = this;
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // nothing to move back -- only the ray goes into object space
+        ray local(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()));
+        return object->occluded(local, ray_t);
+    }
+
+    void calculate_bounding_box() override {
+        bounding_box = object_to_world.apply(object->bounding_box);
+    }
+
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    shared_ptr<hittable> get_object() const { return object; }
+    const transform& get_transform() const { return object_to_world; }
+    const transform& get_inverse_transform() const { return world_to_object; }
+};
+
+
+#endif
@@ -4,52 +4,136 @@
 #define material_h
 
 #include "hittable.h"
+#include "physics/texture.h"
+#include "math/onb.h"
+#include "math/warp.h"
 
 class material {
 public:
     virtual ~material() = default;
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+    // `u` holds 3 uniform random numbers from the sampler -- (x, y) pick a direction, z picks
+    // between reflection / refraction style choices
+
+    virtual bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const {
         return false;
     }
 
+    virtual color emitted(const ray& r_in, const hit_record& rec) const {
+        return color(0, 0, 0);
+    }
+
+    // surface color seen by the denoiser's albedo buffer
+    virtual color albedo_value(const hit_record& rec) const {
+        return color(1, 1, 1);
+    }
+
+    // next event estimation support
+    // only materials with a real (non-delta) pdf can take direct light samples
+    // eval: bsdf * cosine for an arbitrary outgoing direction
+    // scatter_pdf: solid angle pdf of `scatter` generating `scattered`
+    virtual bool is_diffuse() const {
+        return false;
+    }
+
+    virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+        return color(0, 0, 0);
+    }
+
+    virtual double scatter_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return 0;
+    }
+
 };
 
 
 class lambertian : public material {
 private:
     color albedo;
+    shared_ptr<texture> tex;        // null -- the constant albedo
 
 public:
     lambertian(const color& albedo) : albedo(albedo) {}
+    lambertian(shared_ptr<texture> tex) : albedo(1, 1, 1), tex(tex) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const override {
+        return sample(albedo_at(rec), rec, u, attenuation, scattered);
+    }
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
+    bool is_diffuse() const override {
+        return true;
+    }
 
-        // Catch degenerate scatter direction -- default to normal
-        if (scatter_direction.near_zero()) {
-            scatter_direction = rec.normal;
-        }
+    color albedo_value(const hit_record& rec) const override {
+        return albedo_at(rec);
+    }
+
+    color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+        return evaluate(albedo_at(rec), rec, direction);
+    }
+
+    double scatter_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        return pdf(rec, scattered.direction());
+    }
+
+    color albedo_at(const hit_record& rec) const { return tex ? tex->value(rec) : albedo; }
+
+    const color& get_albedo() const { return albedo; }
+    const shared_ptr<texture>& get_texture() const { return tex; }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+    // the material math on its own -- shared with the closed world (devirtualized) scene
+
+    static bool sample(const color& albedo, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) {
+        // cosine distributed around the normal, already unit length
+        vec3 scatter_direction = onb::from_unit(rec.normal).transform(warp_cosine_hemisphere(u.x(), u.y()));
 
         scattered = ray(rec.p, scatter_direction);
         attenuation = albedo;
         return true;
     }
 
+    static color evaluate(const color& albedo, const hit_record& rec, const vec3& direction) {
+        auto cos_theta = dot(rec.normal, unit_vector(direction));
+        return cos_theta < 0 ? color(0, 0, 0) : albedo * (cos_theta / pi);
+    }
+
+    static double pdf(const hit_record& rec, const vec3& direction) {
+        return cosine_hemisphere_pdf(dot(rec.normal, unit_vector(direction)));
+    }
+
 };
 
 class metal : public material {
 private:
     color albedo;
+    shared_ptr<texture> tex;        // null -- the constant albedo
     double fuzz;
 
 public:
     metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+    metal(shared_ptr<texture> tex, double fuzz) : albedo(1, 1, 1), tex(tex), fuzz(fuzz < 1 ? fuzz : 1) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const override {
+        return sample(albedo_at(rec), fuzz, r_in, rec, u, attenuation, scattered);
+    }
+
+    color albedo_value(const hit_record& rec) const override {
+        return albedo_at(rec);
+    }
+
+    color albedo_at(const hit_record& rec) const { return tex ? tex->value(rec) : albedo; }
+
+    const color& get_albedo() const { return albedo; }
+    const shared_ptr<texture>& get_texture() const { return tex; }
+    double get_fuzz() const { return fuzz; }
+
+    static bool sample(const color& albedo, double fuzz, const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) {
         // implemented fuzzy reflection rays
         vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+        reflected = unit_vector(reflected) + (fuzz * warp_uniform_sphere(u.x(), u.y()));
         scattered = ray(rec.p, reflected);
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
@@ -69,13 +153,21 @@ private:
         // polynomial approx. by christphe schlick
         auto r0 = (1 - refraction_index)  / (1 + refraction_index);
         r0 = r0*r0;
-        return r0 + (1-r0)*std::pow((1-cosine), 5);
+        double m = 1 - cosine;
+        double m2 = m * m;
+        return r0 + (1-r0) * (m2 * m2 * m);
     }
 
 public:
     dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const override {
+        return sample(refraction_index, r_in, rec, u, attenuation, scattered);
+    }
+
+    double get_refraction_index() const { return refraction_index; }
+
+    static bool sample(double refraction_index, const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) {
         // refracting dielectric 
         attenuation = color(1.0, 1.0, 1.0);
         double ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
@@ -87,7 +179,7 @@ public:
         bool cannot_refract = ri * sin_thetha > 1.0;
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_thetha, ri) > random_double()){
+        if (cannot_refract || reflectance(cos_thetha, ri) > u.z()){
             direction = reflect(unit_direction, rec.normal);
         }else {
             direction = refract(unit_direction, rec.normal, ri);
@@ -99,4 +191,28 @@ public:
 };
 
 
+class diffuse_light : public material {
+private:
+    color emit;
+
+public:
+    diffuse_light(const color& emit) : emit(emit) {}
+
+    color emitted(const ray& r_in, const hit_record& rec) const override {
+        return emission(emit, rec);
+    }
+
+    const color& get_emit() const { return emit; }
+
+    static color emission(const color& emit, const hit_record& rec) {
+        // only emit from the outside surface
+        if (!rec.front_face) {
+            return color(0, 0, 0);
+        }
+        return emit;
+    }
+
+};
+
+
 #endif
\ No newline at end of file
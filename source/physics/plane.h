@@ -0,0 +1,313 @@
+
+#ifndef plane_h
+#define plane_h
+
+#include "utils/common.h"
+#include "physics/hittable.h"
+#include "math/onb.h"
+
+
+// ----------------------------------------------------- //
+// planar primitives
+// ----------------------------------------------------- //
+// plane (infinite), quad (parallelogram) and disk
+// all three share the ray / plane math -- the quad + disk only add a bounds test on the hit point
+// a plane has no useful bounding box, so it reports is_unbounded() and hittable_list keeps it out
+// of the bvh (see hittable_list::finalize)
+
+// stands in for "infinite" in bounding boxes, like the 1e9 sentinels in bvh_container + transform
+const double unbounded_extent = 1e9;
+
+// flat boxes are padded so the slab test never divides a zero width
+const double planar_padding = 1e-4;
+
+inline bool intersect_plane(const point3& point, const vec3& normal, const ray& r, interval ray_t, double& root) {
+    double denom = dot(normal, r.direction());
+    if (std::fabs(denom) < 1e-12) {
+        // parallel to the plane
+        return false;
+    }
+
+    root = dot(normal, point - r.origin()) / denom;
+    return ray_t.surrounds(root);
+}
+
+inline void fill_planar_hit_record(const vec3& normal, const ray& r, double root, hit_record& rec) {
+    rec.t = root;
+    rec.p = r.at(root);
+    rec.set_face_normal(r, normal);
+}
+
+inline void set_planar_uv(const point3& origin, const vec3& normal, double scale, hit_record& rec) {
+    // coordinates along a fixed tangent frame of the normal -- one unit of u / v is `scale` long
+    onb frame(normal);
+    vec3 offset = rec.p - origin;
+    rec.u = dot(offset, frame.u()) / scale;
+    rec.v = dot(offset, frame.v()) / scale;
+    rec.du = rec.dv = scale;
+}
+
+
+// ----------------------------------------------------- //
+// plane
+// ----------------------------------------------------- //
+
+class plane : public hittable {
+private:
+    point3 point;
+    vec3 normal;
+    shared_ptr<material> mat;
+
+public:
+    plane(const point3& point, const vec3& normal, shared_ptr<material> mat)
+        : point(point), normal(unit_vector(normal)), mat(mat) {
+        initialize_base_objects();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double root;
+        if (!intersect(point, normal, r, ray_t, root)) {
+            return false;
+        }
+
+        fill_hit_record(point, normal, r, root, rec);
+        rec.mat = mat;
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
+        double root;
+        if (!intersect(point, normal, r, ray_t, root)) {
+            return false;
+        }
+        nearest.t = root;
+        nearest.object = this;
+        return true;
+    }
+
+    void fill_hit(const ray& r, interval ray_t, const hit_candidate& nearest, hit_record& rec) const override {
+        fill_hit_record(point, normal, r, nearest.t, rec);
+        rec.mat = mat;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return intersect(point, normal, r, ray_t, root);
+    }
+
+    bool is_unbounded() const override { return true; }
+
+    void calculate_bounding_box() override {
+        bounding_box = aabb(vec3(-unbounded_extent, -unbounded_extent, -unbounded_extent),
+                            vec3(unbounded_extent, unbounded_extent, unbounded_extent));
+    }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+    // shared with the closed world scene
+
+    static bool intersect(const point3& point, const vec3& normal, const ray& r, interval ray_t, double& root) {
+        return intersect_plane(point, normal, r, ray_t, root);
+    }
+
+    static void fill_hit_record(const point3& point, const vec3& normal, const ray& r, double root, hit_record& rec) {
+        // textures repeat every world unit
+        fill_planar_hit_record(normal, r, root, rec);
+        set_planar_uv(point, normal, 1.0, rec);
+    }
+
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    const point3& get_point() const { return point; }
+    const vec3& get_normal() const { return normal; }
+    shared_ptr<material> get_material() const { return mat; }
+};
+
+
+// ----------------------------------------------------- //
+// quad
+// ----------------------------------------------------- //
+// the parallelogram corner, corner + u, corner + v, corner + u + v
+// axis aligned quads are the common case (floors, walls) but any orientation works
+
+class quad : public hittable {
+private:
+    point3 corner;
+    vec3 u, v;
+    shared_ptr<material> mat;
+
+public:
+    quad(const point3& corner, const vec3& u, const vec3& v, shared_ptr<material> mat)
+        : corner(corner), u(u), v(v), mat(mat) {
+        initialize_base_objects();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double root;
+        if (!intersect(corner, u, v, r, ray_t, root)) {
+            return false;
+        }
+
+        fill_hit_record(corner, u, v, r, root, rec);
+        rec.mat = mat;
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
+        double root;
+        if (!intersect(corner, u, v, r, ray_t, root)) {
+            return false;
+        }
+        nearest.t = root;
+        nearest.object = this;
+        return true;
+    }
+
+    void fill_hit(const ray& r, interval ray_t, const hit_candidate& nearest, hit_record& rec) const override {
+        fill_hit_record(corner, u, v, r, nearest.t, rec);
+        rec.mat = mat;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return intersect(corner, u, v, r, ray_t, root);
+    }
+
+    void calculate_bounding_box() override {
+        vec3 _min = vec3::min(vec3::min(corner, corner + u), vec3::min(corner + v, corner + u + v));
+        vec3 _max = vec3::max(vec3::max(corner, corner + u), vec3::max(corner + v, corner + u + v));
+        vec3 pad(planar_padding, planar_padding, planar_padding);
+
+        bounding_box = aabb(_min - pad, _max + pad);
+    }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+
+    static bool intersect(const point3& corner, const vec3& u, const vec3& v, const ray& r, interval ray_t, double& root) {
+        vec3 n = cross(u, v);
+        if (!intersect_plane(corner, n, r, ray_t, root)) {
+            return false;
+        }
+
+        // plane coordinates of the hit point -- inside if both are in [0, 1]
+        vec3 w = n / dot(n, n);
+        vec3 planar = r.at(root) - corner;
+        double alpha = dot(w, cross(planar, v));
+        double beta = dot(w, cross(u, planar));
+        return alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1;
+    }
+
+    static void fill_hit_record(const point3& corner, const vec3& u, const vec3& v, const ray& r, double root, hit_record& rec) {
+        vec3 n = cross(u, v);
+        fill_planar_hit_record(unit_vector(n), r, root, rec);
+
+        // (u, v) are the plane coordinates of the hit -- [0, 1] across the quad
+        vec3 w = n / dot(n, n);
+        vec3 planar = rec.p - corner;
+        rec.u = dot(w, cross(planar, v));
+        rec.v = dot(w, cross(u, planar));
+        rec.du = u.length();
+        rec.dv = v.length();
+    }
+
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    const point3& get_corner() const { return corner; }
+    const vec3& get_u() const { return u; }
+    const vec3& get_v() const { return v; }
+    shared_ptr<material> get_material() const { return mat; }
+};
+
+
+// ----------------------------------------------------- //
+// disk
+// ----------------------------------------------------- //
+
+class disk : public hittable {
+private:
+    point3 center;
+    vec3 normal;
+    double radius;
+    shared_ptr<material> mat;
+
+public:
+    disk(const point3& center, const vec3& normal, double radius, shared_ptr<material> mat)
+        : center(center), normal(unit_vector(normal)), radius(std::fmax(0, radius)), mat(mat) {
+        initialize_base_objects();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double root;
+        if (!intersect(center, normal, radius, r, ray_t, root)) {
+            return false;
+        }
+
+        fill_hit_record(center, normal, radius, r, root, rec);
+        rec.mat = mat;
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
+        double root;
+        if (!intersect(center, normal, radius, r, ray_t, root)) {
+            return false;
+        }
+        nearest.t = root;
+        nearest.object = this;
+        return true;
+    }
+
+    void fill_hit(const ray& r, interval ray_t, const hit_candidate& nearest, hit_record& rec) const override {
+        fill_hit_record(center, normal, radius, r, nearest.t, rec);
+        rec.mat = mat;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return intersect(center, normal, radius, r, ray_t, root);
+    }
+
+    void calculate_bounding_box() override {
+        // the disk reaches radius * sin(angle between the axis and the normal) along each axis
+        vec3 extent(radius * std::sqrt(std::fmax(0, 1 - normal.x() * normal.x())) + planar_padding,
+                    radius * std::sqrt(std::fmax(0, 1 - normal.y() * normal.y())) + planar_padding,
+                    radius * std::sqrt(std::fmax(0, 1 - normal.z() * normal.z())) + planar_padding);
+
+        bounding_box = aabb(center - extent, center + extent);
+    }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+
+    static bool intersect(const point3& center, const vec3& normal, double radius, const ray& r, interval ray_t, double& root) {
+        if (!intersect_plane(center, normal, r, ray_t, root)) {
+            return false;
+        }
+        return (r.at(root) - center).length_squared() <= radius * radius;
+    }
+
+    static void fill_hit_record(const point3& center, const vec3& normal, double radius, const ray& r, double root, hit_record& rec) {
+        // (u, v) in [0, 1] across the disk's bounding square
+        fill_planar_hit_record(normal, r, root, rec);
+        set_planar_uv(center, normal, 2 * radius, rec);
+        rec.u += 0.5;
+        rec.v += 0.5;
+    }
+
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    const point3& get_center() const { return center; }
+    const vec3& get_normal() const { return normal; }
+    double get_radius() const { return radius; }
+    shared_ptr<material> get_material() const { return mat; }
+};
+
+
+#endif
@@ -0,0 +1,86 @@
+
+
+#ifndef scene_view_h
+#define scene_view_h
+
+#include "utils/common.h"
+
+#include "physics/hittable.h"
+#include "physics/hittable_list.h"
+#include "physics/material.h"
+
+
+// ----------------------------------------------------- //
+// virtual_scene
+// ----------------------------------------------------- //
+// the interface camera::ray_color is templated on -- a scene answers intersection, material
+// and light sampling queries about a hit_record it produced
+// this one forwards to the virtual hittable / material calls (the open world default)
+// see closed_scene for the devirtualized version
+
+class virtual_scene {
+private:
+    const hittable_list* world;
+
+public:
+    explicit virtual_scene(const hittable_list* world) : world(world) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        return world->hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        return world->occluded(r, ray_t);
+    }
+
+    // ----------------------------------------------------- //
+    // materials
+    // ----------------------------------------------------- //
+
+    bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const {
+        return rec.mat->scatter(r_in, rec, u, attenuation, scattered);
+    }
+
+    color emitted(const ray& r_in, const hit_record& rec) const {
+        return rec.mat->emitted(r_in, rec);
+    }
+
+    color albedo_value(const hit_record& rec) const {
+        return rec.mat->albedo_value(rec);
+    }
+
+    bool is_diffuse(const hit_record& rec) const {
+        return rec.mat->is_diffuse();
+    }
+
+    color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+        return rec.mat->eval(r_in, rec, direction);
+    }
+
+    double scatter_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+        return rec.mat->scatter_pdf(r_in, rec, ray(rec.p, direction));
+    }
+
+    // ----------------------------------------------------- //
+    // lights
+    // ----------------------------------------------------- //
+
+    bool has_lights() const {
+        return world->has_lights();
+    }
+
+    double light_pdf_value(const point3& origin, const vec3& direction) const {
+        return world->light_pdf_value(origin, direction);
+    }
+
+    vec3 sample_light(const point3& origin, const vec3& u) const {
+        return world->sample_light(origin, u);
+    }
+
+    bool hit_lights(const ray& r, interval ray_t, hit_record& rec) const {
+        return world->hit_lights(r, ray_t, rec);
+    }
+};
+
+
+#endif
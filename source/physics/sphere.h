@@ -4,6 +4,8 @@
 #define sphere_h
 
 #include "utils/common.h"
+#include "math/onb.h"
+#include "math/warp.h"
 
 
 class sphere : public hittable {
@@ -22,9 +24,61 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // direclty edit the hit_record object
+        double root;
+        if (!intersect(center, radius, r, ray_t, root)) {
+            return false;
+        }
+
+        fill_hit_record(center, radius, r, root, rec);
+        rec.mat = mat;
+
+        return true;
+    }
+
+    bool hit_distance(const ray& r, interval ray_t, hit_candidate& nearest) const override {
+        double root;
+        if (!intersect(center, radius, r, ray_t, root)) {
+            return false;
+        }
+        nearest.t = root;
+        nearest.object = this;
+        return true;
+    }
+
+    void fill_hit(const ray& r, interval ray_t, const hit_candidate& nearest, hit_record& rec) const override {
+        fill_hit_record(center, radius, r, nearest.t, rec);
+        rec.mat = mat;
+    }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return intersect(center, radius, r, ray_t, root);
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        return cone_pdf(center, radius, origin, direction);
+    }
+
+    vec3 random(const point3& origin, double u1, double u2) const override {
+        return cone_sample(center, radius, origin, u1, u2);
+    }
+
+    void calculate_bounding_box() override {
+        // TODO : implement this function
+        vec3 _min = center - vec3(radius, radius, radius);
+        vec3 _max = center + vec3(radius, radius, radius);
+
+        bounding_box = aabb(_min, _max);
+    }
+
+    // ----------------------------------------------------- //
+    // static functions
+    // ----------------------------------------------------- //
+    // the sphere math on its own -- shared with the closed world (devirtualized) scene
+
+    static bool intersect(const point3& center, double radius, const ray& r, interval ray_t, double& root) {
         vec3 oc = center - r.origin();
-    
+
         auto a = r.direction().length_squared();
         auto h = dot(r.direction(), oc);
         auto c = oc.length_squared() - radius*radius;
@@ -34,9 +88,9 @@ public:
         if (disc < 0) return false;
 
         auto sqrtd = std::sqrt(disc);
- 
+
         // find nearest root that lies in acceptable range
-        auto root = (h - sqrtd) / a;
+        root = (h - sqrtd) / a;
         if (!ray_t.surrounds(root)) {
             root = (h + sqrtd) / a;
 
@@ -44,24 +98,65 @@ public:
             if (!ray_t.surrounds(root))
                 return false;
         }
+        return true;
+    }
 
+    static void fill_hit_record(const point3& center, double radius, const ray& r, double root, hit_record& rec) {
         rec.t = root;
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
+        set_uv(outward_normal, radius, rec);
+    }
 
-        return true;
+    static void set_uv(const vec3& outward_normal, double radius, hit_record& rec) {
+        // u: angle around the y axis from x = -1, v: angle from y = -1 up to y = +1
+        // one unit of u spans the whole circle of latitude, one unit of v half a great circle
+        double y = std::fmax(-1.0, std::fmin(1.0, outward_normal.y()));
+        rec.u = (std::atan2(-outward_normal.z(), outward_normal.x()) + pi) / (2 * pi);
+        rec.v = std::acos(-y) / pi;
+        rec.du = 2 * pi * radius * std::sqrt(1 - y * y);
+        rec.dv = pi * radius;
     }
 
-    void calculate_bounding_box() override {
-        // TODO : implement this function
-        vec3 _min = center - vec3(radius, radius, radius);
-        vec3 _max = center + vec3(radius, radius, radius);
+    static double cone_pdf(const point3& center, double radius, const point3& origin, const vec3& direction) {
+        // uniform over the cone of directions the sphere covers -- only valid if the ray hits
+        double root;
+        if (!intersect(center, radius, ray(origin, direction), interval(0.001, infinity), root)) {
+            return 0;
+        }
 
-        bounding_box = aabb(_min, _max);
+        auto dist_squared = (center - origin).length_squared();
+        if (dist_squared <= radius*radius) {
+            // origin inside the sphere -- every direction hits it
+            return uniform_sphere_pdf();
+        }
+
+        auto cos_theta_max = std::sqrt(1 - radius*radius / dist_squared);
+        auto solid_angle = 2 * pi * (1 - cos_theta_max);
+
+        return 1 / solid_angle;
+    }
+
+    static vec3 cone_sample(const point3& center, double radius, const point3& origin, double u1, double u2) {
+        vec3 direction = center - origin;
+        auto dist_squared = direction.length_squared();
+        if (dist_squared <= radius*radius) {
+            return warp_uniform_sphere(u1, u2);
+        }
+
+        onb uvw(direction);
+        auto cos_theta_max = std::sqrt(1 - radius*radius / dist_squared);
+        return uvw.transform(warp_uniform_cone(u1, u2, cos_theta_max));
     }
 
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    const point3& get_center() const { return center; }
+    double get_radius() const { return radius; }
+    shared_ptr<material> get_material() const { return mat; }
+
 };
 
-#endif
\ No newline at end of file
+#endif
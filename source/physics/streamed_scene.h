@@ -0,0 +1,689 @@
+
+#ifndef streamed_scene_h
+#define streamed_scene_h
+
+#include "utils/common.h"
+
+#include "physics/hittable.h"
+#include "physics/material.h"
+#include "physics/sphere.h"
+#include "physics/closed_scene.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ----------------------------------------------------- //
+// out of core geometry
+// ----------------------------------------------------- //
+// spheres live in a file as fixed size, page aligned clusters of spatially close spheres
+// (morton order). only the top of the hierarchy -- one box per cluster + the tree over them,
+// the materials and the lights -- is read into memory. clusters are memory mapped and paged
+// in on demand; each process keeps at most `resident_budget` bytes of them mapped and drops
+// the least recently used (clock) with madvise, so the kernel can reclaim the pages
+//
+// file layout:
+//   header                                     (one page)
+//   materials | lights | top nodes             (resident, read at open)
+//   clusters                                   (page aligned, cluster_bytes each)
+//
+// cluster layout:
+//   stream_cluster_header | stream_group[group_count] | stream_sphere[sphere_count]
+
+struct stream_sphere {
+    float center[3];
+    float radius;
+    int32_t material;
+};
+
+struct stream_box {
+    float min[3];
+    float max[3];
+
+    void reset() {
+        for (int a = 0; a < 3; a++) {
+            min[a] = std::numeric_limits<float>::max();
+            max[a] = -std::numeric_limits<float>::max();
+        }
+    }
+
+    void expand(const stream_sphere& s) {
+        for (int a = 0; a < 3; a++) {
+            min[a] = std::min(min[a], s.center[a] - s.radius);
+            max[a] = std::max(max[a], s.center[a] + s.radius);
+        }
+    }
+
+    void expand(const stream_box& b) {
+        for (int a = 0; a < 3; a++) {
+            min[a] = std::min(min[a], b.min[a]);
+            max[a] = std::max(max[a], b.max[a]);
+        }
+    }
+
+    // slab test clipped to [t_min, t_max] -- t_enter is where the ray enters the box
+    bool hit(const ray& r, const vec3& inv_dir, double t_min, double t_max, double& t_enter) const {
+        for (int a = 0; a < 3; a++) {
+            double t0 = (min[a] - r.origin()[a]) * inv_dir[a];
+            double t1 = (max[a] - r.origin()[a]) * inv_dir[a];
+            if (t0 > t1) std::swap(t0, t1);
+            t_min = std::max(t_min, t0);
+            t_max = std::min(t_max, t1);
+            if (t_max < t_min) return false;
+        }
+        t_enter = t_min;
+        return true;
+    }
+};
+
+struct stream_group {
+    stream_box box;
+    int32_t first;
+    int32_t count;
+};
+
+struct stream_cluster_header {
+    int32_t group_count;
+    int32_t sphere_count;
+};
+
+struct stream_node {
+    stream_box box;
+    int32_t left, right;        // interior nodes
+    int32_t cluster;            // leaves -- -1 for interior nodes
+    int32_t pad;
+};
+
+struct stream_file_header {
+    char magic[8];
+    uint64_t cluster_bytes;
+    uint64_t cluster_capacity;  // spheres per cluster
+    uint64_t cluster_count;
+    uint64_t node_count;
+    uint64_t material_count;
+    uint64_t light_count;
+    uint64_t sphere_count;
+    uint64_t clusters_offset;
+};
+
+const size_t stream_page_size = 4096;
+const int stream_group_size = 8;
+
+inline size_t stream_round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+// ----------------------------------------------------- //
+// streamed_scene_builder
+// ----------------------------------------------------- //
+// writes a streamed scene file without keeping the spheres in memory -- they are appended to a
+// temp file, which is then sorted in place through a memory map and cut into clusters
+
+class streamed_scene_builder {
+private:
+    std::string temp_path;
+    std::ofstream temp;
+    size_t sphere_count;
+    std::vector<closed_material> materials;
+    std::vector<stream_sphere> lights;
+
+public:
+    explicit streamed_scene_builder(const std::string& temp_path)
+        : temp_path(temp_path), temp(temp_path, std::ios::binary | std::ios::trunc), sphere_count(0) {
+        if (!temp.is_open()) {
+            std::cerr << "Error: streamed scene temp file failed to open: " << temp_path << std::endl;
+        }
+    }
+
+    // -1 for materials the closed world does not support
+    int add_material(const shared_ptr<material>& mat) {
+        closed_material m;
+        if (!closed_material_table::describe(mat.get(), m)) {
+            std::cerr << "Error: streamed scenes do not support this material" << std::endl;
+            return -1;
+        }
+        materials.push_back(m);
+        return int(materials.size()) - 1;
+    }
+
+    void add_sphere(const point3& center, double radius, int material) {
+        stream_sphere s = {{float(center.x()), float(center.y()), float(center.z())}, float(radius), material};
+        temp.write(reinterpret_cast<const char*>(&s), sizeof(s));
+        sphere_count++;
+    }
+
+    // lights are ordinary spheres that are also kept resident for light sampling
+    void add_light(const point3& center, double radius, int material) {
+        add_sphere(center, radius, material);
+        lights.push_back({{float(center.x()), float(center.y()), float(center.z())}, float(radius), material});
+    }
+
+    size_t size() const { return sphere_count; }
+
+    bool write(const std::string& path, int cluster_pages = 1) {
+        temp.close();
+        if (sphere_count == 0) {
+            std::cerr << "Error: streamed scene has no spheres" << std::endl;
+            return false;
+        }
+
+        int fd = open(temp_path.c_str(), O_RDWR);
+        if (fd < 0) {
+            std::cerr << "Error: streamed scene temp file failed to open: " << temp_path << std::endl;
+            return false;
+        }
+        size_t bytes = sphere_count * sizeof(stream_sphere);
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: streamed scene temp file failed to map" << std::endl;
+            return false;
+        }
+        stream_sphere* spheres = static_cast<stream_sphere*>(memory);
+
+        sort_spheres(spheres);
+        bool ok = write_clusters(path, spheres, cluster_pages);
+
+        munmap(memory, bytes);
+        std::remove(temp_path.c_str());
+        return ok;
+    }
+
+private:
+    void sort_spheres(stream_sphere* spheres) const {
+        // morton order of the centers -- neighbors in the file are neighbors in space
+        // 21 bits per axis, so one huge sphere (a ground plane) far off does not squash the rest
+        // of the scene into a handful of cells
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::numeric_limits<float>::max();
+            hi[a] = -std::numeric_limits<float>::max();
+        }
+        for (size_t i = 0; i < sphere_count; i++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], spheres[i].center[a]);
+                hi[a] = std::max(hi[a], spheres[i].center[a]);
+            }
+        }
+
+        const double cells = double((1 << 21) - 1);
+        double scale[3];
+        for (int a = 0; a < 3; a++) {
+            scale[a] = hi[a] > lo[a] ? cells / (double(hi[a]) - lo[a]) : 0.0;
+        }
+
+        auto key = [&lo, &scale, cells](const stream_sphere& s) {
+            uint64_t k = 0;
+            for (int a = 0; a < 3; a++) {
+                uint64_t v = uint64_t(std::min(cells, std::max(0.0, (double(s.center[a]) - lo[a]) * scale[a])));
+                for (int bit = 0; bit < 21; bit++) {
+                    k |= ((v >> bit) & 1ULL) << (3 * bit + a);
+                }
+            }
+            return k;
+        };
+
+        std::sort(spheres, spheres + sphere_count, [&key](const stream_sphere& a, const stream_sphere& b) {
+            return key(a) < key(b);
+        });
+    }
+
+    bool write_clusters(const std::string& path, const stream_sphere* spheres, int cluster_pages) const {
+        stream_file_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "rtclus2", 8);
+
+        // as many whole groups as fit one cluster -- every sphere costs its record + 1/8 group
+        header.cluster_bytes = stream_page_size * size_t(std::max(1, cluster_pages));
+        size_t per_group = sizeof(stream_group) + stream_group_size * sizeof(stream_sphere);
+        header.cluster_capacity = (header.cluster_bytes - sizeof(stream_cluster_header)) / per_group * stream_group_size;
+        header.cluster_count = (sphere_count + header.cluster_capacity - 1) / header.cluster_capacity;
+        header.node_count = 2 * header.cluster_count - 1;
+        header.material_count = materials.size();
+        header.light_count = lights.size();
+        header.sphere_count = sphere_count;
+
+        size_t resident_bytes = materials.size() * sizeof(closed_material) + lights.size() * sizeof(stream_sphere)
+                              + header.node_count * sizeof(stream_node);
+        header.clusters_offset = stream_round_up(stream_page_size + resident_bytes, stream_page_size);
+
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            std::cerr << "Error: streamed scene file failed to open: " << path << std::endl;
+            return false;
+        }
+
+        // clusters first -- their boxes are the leaves of the top tree
+        std::vector<stream_box> cluster_boxes(header.cluster_count);
+        std::vector<char> page(header.cluster_bytes);
+        output.seekp(std::streamoff(header.clusters_offset));
+
+        for (size_t c = 0; c < header.cluster_count; c++) {
+            size_t first = c * header.cluster_capacity;
+            int count = int(std::min<size_t>(header.cluster_capacity, sphere_count - first));
+            int group_count = (count + stream_group_size - 1) / stream_group_size;
+
+            std::fill(page.begin(), page.end(), 0);
+            stream_cluster_header* cluster = reinterpret_cast<stream_cluster_header*>(page.data());
+            stream_group* groups = reinterpret_cast<stream_group*>(cluster + 1);
+            stream_sphere* records = reinterpret_cast<stream_sphere*>(groups + group_count);
+            cluster->group_count = group_count;
+            cluster->sphere_count = count;
+
+            cluster_boxes[c].reset();
+            for (int g = 0; g < group_count; g++) {
+                groups[g].first = g * stream_group_size;
+                groups[g].count = std::min(stream_group_size, count - groups[g].first);
+                groups[g].box.reset();
+                for (int i = groups[g].first; i < groups[g].first + groups[g].count; i++) {
+                    records[i] = spheres[first + i];
+                    groups[g].box.expand(records[i]);
+                }
+                cluster_boxes[c].expand(groups[g].box);
+            }
+
+            output.write(page.data(), std::streamsize(page.size()));
+        }
+
+        std::vector<stream_node> nodes;
+        nodes.reserve(header.node_count);
+        build_nodes(nodes, cluster_boxes, 0, int(header.cluster_count));
+
+        output.seekp(0);
+        std::vector<char> header_page(stream_page_size, 0);
+        std::memcpy(header_page.data(), &header, sizeof(header));
+        output.write(header_page.data(), std::streamsize(header_page.size()));
+        output.write(reinterpret_cast<const char*>(materials.data()), std::streamsize(materials.size() * sizeof(closed_material)));
+        output.write(reinterpret_cast<const char*>(lights.data()), std::streamsize(lights.size() * sizeof(stream_sphere)));
+        output.write(reinterpret_cast<const char*>(nodes.data()), std::streamsize(nodes.size() * sizeof(stream_node)));
+
+        std::cout << "Streamed scene: " << sphere_count << " spheres in " << header.cluster_count << " clusters of "
+                  << header.cluster_bytes << " bytes" << std::endl;
+        return bool(output);
+    }
+
+    static int build_nodes(std::vector<stream_node>& nodes, const std::vector<stream_box>& boxes, int first, int last) {
+        // clusters are already in morton order -- halving the range makes a balanced tree
+        int id = int(nodes.size());
+        nodes.push_back(stream_node());
+        nodes[id].cluster = -1;
+        nodes[id].pad = 0;
+
+        if (last - first == 1) {
+            nodes[id].box = boxes[first];
+            nodes[id].left = nodes[id].right = -1;
+            nodes[id].cluster = first;
+            return id;
+        }
+
+        int middle = (first + last) / 2;
+        int left = build_nodes(nodes, boxes, first, middle);
+        int right = build_nodes(nodes, boxes, middle, last);
+        nodes[id].left = left;
+        nodes[id].right = right;
+        nodes[id].box = nodes[left].box;
+        nodes[id].box.expand(nodes[right].box);
+        return id;
+    }
+};
+
+
+// ----------------------------------------------------- //
+// streamed_scene
+// ----------------------------------------------------- //
+// same interface as closed_scene (camera::ray_color is templated on it), reading a file
+// written by streamed_scene_builder
+
+struct stream_statistics {
+    std::atomic<uint64_t> accesses;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
+class streamed_scene : public closed_material_table {
+private:
+    static const int max_stack = 64;
+
+    stream_file_header header;
+    std::vector<stream_sphere> lights;
+    std::vector<stream_node> nodes;
+
+    const char* mapped;
+    size_t mapped_bytes;
+
+    // per process residency (a clock over the clusters that are mapped in) -- forked workers
+    // each get their own copy
+    mutable std::vector<int32_t> slot_of;       // cluster -> slot, -1 if not resident
+    mutable std::vector<int32_t> slots;         // slot -> cluster, -1 if free
+    mutable std::vector<uint8_t> referenced;
+    mutable size_t hand;
+    size_t resident_budget;
+
+    // counted locally, added to the shared totals in batches
+    mutable uint64_t local_accesses, local_misses, local_evictions;
+    stream_statistics* statistics;              // MAP_SHARED -- totals over every process
+
+public:
+    streamed_scene()
+        : mapped(nullptr), mapped_bytes(0), hand(0), resident_budget(0),
+          local_accesses(0), local_misses(0), local_evictions(0), statistics(nullptr) {
+        std::memset(&header, 0, sizeof(header));
+    }
+
+    ~streamed_scene() {
+        if (mapped != nullptr) munmap(const_cast<char*>(mapped), mapped_bytes);
+        if (statistics != nullptr) munmap(statistics, sizeof(stream_statistics));
+    }
+
+    streamed_scene(const streamed_scene&) = delete;
+    streamed_scene& operator=(const streamed_scene&) = delete;
+
+    bool open_file(const std::string& path, size_t resident_budget_bytes) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input.is_open()) {
+            std::cerr << "Error: streamed scene file failed to open: " << path << std::endl;
+            return false;
+        }
+
+        input.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!input || std::memcmp(header.magic, "rtclus2", 8) != 0) {
+            std::cerr << "Error: not a streamed scene file: " << path << std::endl;
+            return false;
+        }
+
+        // the resident part
+        materials.resize(header.material_count);
+        lights.resize(header.light_count);
+        nodes.resize(header.node_count);
+        input.seekg(std::streamoff(stream_page_size));
+        input.read(reinterpret_cast<char*>(materials.data()), std::streamsize(materials.size() * sizeof(closed_material)));
+        input.read(reinterpret_cast<char*>(lights.data()), std::streamsize(lights.size() * sizeof(stream_sphere)));
+        input.read(reinterpret_cast<char*>(nodes.data()), std::streamsize(nodes.size() * sizeof(stream_node)));
+        if (!input) {
+            std::cerr << "Error: streamed scene file is truncated: " << path << std::endl;
+            return false;
+        }
+
+        // the clusters -- mapped, never read up front
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        mapped_bytes = header.clusters_offset + header.cluster_count * header.cluster_bytes;
+        void* memory = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: streamed scene file failed to map: " << path << std::endl;
+            mapped = nullptr;
+            return false;
+        }
+        mapped = static_cast<const char*>(memory);
+        madvise(memory, mapped_bytes, MADV_RANDOM);       // no read ahead past the cluster that was asked for
+
+        resident_budget = std::max<size_t>(1, resident_budget_bytes / header.cluster_bytes);
+        slot_of.assign(header.cluster_count, -1);
+        slots.assign(std::min<size_t>(resident_budget, header.cluster_count), -1);
+        referenced.assign(slots.size(), 0);
+        hand = 0;
+
+        void* shared = mmap(nullptr, sizeof(stream_statistics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared != MAP_FAILED) {
+            statistics = new (shared) stream_statistics();
+            statistics->accesses.store(0);
+            statistics->misses.store(0);
+            statistics->evictions.store(0);
+        }
+
+        std::cout << "Streamed scene: " << header.sphere_count << " spheres, " << header.cluster_count << " clusters, resident budget "
+                  << slots.size() << " clusters (" << (slots.size() * header.cluster_bytes >> 20) << " MB)" << std::endl;
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+
+        int stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        // the nearest sphere so far is copied out of its cluster -- the cluster may be evicted
+        // before the traversal ends, and only the winner's hit_record is filled
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+        stream_sphere nearest = {};
+        int64_t nearest_id = -1;
+
+        while (top > 0) {
+            const stream_node& node = nodes[stack[--top]];
+
+            if (node.cluster >= 0) {
+                if (nearest_in_cluster(node.cluster, r, inv_dir, interval(ray_t.min, closest_so_far), closest_so_far, nearest, nearest_id)) {
+                    hit_anything = true;
+                }
+                continue;
+            }
+
+            // nearer child on top -- its hits cut the farther one short, so fewer clusters page in
+            double t_left, t_right;
+            TRAVERSAL_COUNTERS.nodes += 2;
+            bool left = nodes[node.left].box.hit(r, inv_dir, ray_t.min, closest_so_far, t_left);
+            bool right = nodes[node.right].box.hit(r, inv_dir, ray_t.min, closest_so_far, t_right);
+            if (left && right) {
+                bool left_first = t_left <= t_right;
+                stack[top++] = left_first ? node.right : node.left;
+                stack[top++] = left_first ? node.left : node.right;
+            } else if (left) {
+                stack[top++] = node.left;
+            } else if (right) {
+                stack[top++] = node.right;
+            }
+        }
+
+        if (hit_anything) {
+            sphere::fill_hit_record(center_of(nearest), nearest.radius, r, closest_so_far, rec);
+            rec.material_id = nearest.material;
+            rec.primitive_id = nearest_id;
+        }
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const {
+        // any hit -- stops paging clusters in as soon as one blocks the ray
+        vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+
+        int stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const stream_node& node = nodes[stack[--top]];
+
+            if (node.cluster >= 0) {
+                if (occluded_cluster(node.cluster, r, inv_dir, ray_t)) return true;
+                continue;
+            }
+
+            double t_enter;
+            TRAVERSAL_COUNTERS.nodes += 2;
+            if (nodes[node.right].box.hit(r, inv_dir, ray_t.min, ray_t.max, t_enter)) stack[top++] = node.right;
+            if (nodes[node.left].box.hit(r, inv_dir, ray_t.min, ray_t.max, t_enter)) stack[top++] = node.left;
+        }
+
+        return false;
+    }
+
+    // ----------------------------------------------------- //
+    // lights
+    // ----------------------------------------------------- //
+
+    bool has_lights() const {
+        return !lights.empty();
+    }
+
+    double light_pdf_value(const point3& origin, const vec3& direction) const {
+        double sum = 0.0;
+        for (const stream_sphere& light : lights) {
+            sum += sphere::cone_pdf(center_of(light), light.radius, origin, direction);
+        }
+        return sum / lights.size();
+    }
+
+    vec3 sample_light(const point3& origin, const vec3& u) const {
+        int index = std::min(int(u.z() * lights.size()), int(lights.size()) - 1);
+        const stream_sphere& light = lights[index];
+        return sphere::cone_sample(center_of(light), light.radius, origin, u.x(), u.y());
+    }
+
+    bool hit_lights(const ray& r, interval ray_t, hit_record& rec) const {
+        // the resident copies -- no cluster has to page in
+        bool hit_anything = false;
+        for (const stream_sphere& light : lights) {
+            double root;
+            if (sphere::intersect(center_of(light), light.radius, r, ray_t, root)) {
+                sphere::fill_hit_record(center_of(light), light.radius, r, root, rec);
+                rec.material_id = light.material;
+                rec.primitive_id = -1;
+                hit_anything = true;
+                ray_t.max = root;
+            }
+        }
+        return hit_anything;
+    }
+
+    // ----------------------------------------------------- //
+    // statistics
+    // ----------------------------------------------------- //
+
+    // adds this process' counts to the shared totals -- call when a worker is done
+    void flush_statistics() const {
+        if (statistics == nullptr) return;
+
+        statistics->accesses.fetch_add(local_accesses, std::memory_order_relaxed);
+        statistics->misses.fetch_add(local_misses, std::memory_order_relaxed);
+        statistics->evictions.fetch_add(local_evictions, std::memory_order_relaxed);
+        local_accesses = local_misses = local_evictions = 0;
+    }
+
+    void print_statistics(std::ostream& out) const {
+        if (statistics == nullptr) return;
+
+        uint64_t accesses = statistics->accesses.load();
+        uint64_t misses = statistics->misses.load();
+        double hit_rate = accesses > 0 ? 100.0 * (accesses - misses) / accesses : 100.0;
+        out << "Streaming: " << accesses << " cluster visits, " << hit_rate << "% resident, "
+            << misses << " page ins, " << statistics->evictions.load() << " evictions" << std::endl;
+    }
+
+private:
+    static point3 center_of(const stream_sphere& s) {
+        return point3(s.center[0], s.center[1], s.center[2]);
+    }
+
+    bool occluded_cluster(int id, const ray& r, const vec3& inv_dir, interval ray_t) const {
+        const char* base = acquire(id);
+        const stream_cluster_header* cluster = reinterpret_cast<const stream_cluster_header*>(base);
+        const stream_group* groups = reinterpret_cast<const stream_group*>(cluster + 1);
+        const stream_sphere* spheres = reinterpret_cast<const stream_sphere*>(groups + cluster->group_count);
+
+        for (int g = 0; g < cluster->group_count; g++) {
+            double t_enter;
+            TRAVERSAL_COUNTERS.nodes++;
+            if (!groups[g].box.hit(r, inv_dir, ray_t.min, ray_t.max, t_enter)) {
+                continue;
+            }
+
+            for (int i = groups[g].first; i < groups[g].first + groups[g].count; i++) {
+                TRAVERSAL_COUNTERS.primitives++;
+                double root;
+                if (sphere::intersect(center_of(spheres[i]), spheres[i].radius, r, ray_t, root)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool nearest_in_cluster(int id, const ray& r, const vec3& inv_dir, interval ray_t, double& t, stream_sphere& nearest, int64_t& nearest_id) const {
+        // distance only -- sets t + copies the sphere if one is hit inside ray_t
+        const char* base = acquire(id);
+        const stream_cluster_header* cluster = reinterpret_cast<const stream_cluster_header*>(base);
+        const stream_group* groups = reinterpret_cast<const stream_group*>(cluster + 1);
+        const stream_sphere* spheres = reinterpret_cast<const stream_sphere*>(groups + cluster->group_count);
+
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+        for (int g = 0; g < cluster->group_count; g++) {
+            double t_enter;
+            TRAVERSAL_COUNTERS.nodes++;
+            if (!groups[g].box.hit(r, inv_dir, ray_t.min, closest_so_far, t_enter)) {
+                continue;
+            }
+            TRAVERSAL_COUNTERS.primitives += groups[g].count;
+
+            for (int i = groups[g].first; i < groups[g].first + groups[g].count; i++) {
+                double root;
+                if (!sphere::intersect(center_of(spheres[i]), spheres[i].radius, r, interval(ray_t.min, closest_so_far), root)) {
+                    continue;
+                }
+                nearest = spheres[i];
+                nearest_id = int64_t(id) * int64_t(header.cluster_capacity) + i;
+                hit_anything = true;
+                closest_so_far = root;
+            }
+        }
+
+        if (hit_anything) {
+            t = closest_so_far;
+        }
+        return hit_anything;
+    }
+
+    const char* acquire(int id) const {
+        // marks the cluster as used, evicting another one if it was not resident
+        local_accesses++;
+        if (local_accesses >= (1U << 16)) {
+            flush_statistics();
+        }
+
+        const char* base = mapped + header.clusters_offset + size_t(id) * header.cluster_bytes;
+        if (slot_of[id] >= 0) {
+            referenced[slot_of[id]] = 1;
+            return base;
+        }
+
+        // clock -- skip (and clear) recently used slots
+        local_misses++;
+        while (slots[hand] >= 0 && referenced[hand]) {
+            referenced[hand] = 0;
+            hand = (hand + 1) % slots.size();
+        }
+        if (slots[hand] >= 0) {
+            int victim = slots[hand];
+            const char* victim_base = mapped + header.clusters_offset + size_t(victim) * header.cluster_bytes;
+            madvise(const_cast<char*>(victim_base), header.cluster_bytes, MADV_DONTNEED);
+            slot_of[victim] = -1;
+            local_evictions++;
+        }
+
+        slots[hand] = id;
+        slot_of[id] = int32_t(hand);
+        referenced[hand] = 1;
+        hand = (hand + 1) % slots.size();
+        return base;
+    }
+};
+
+
+#endif
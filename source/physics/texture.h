@@ -0,0 +1,119 @@
+
+#ifndef texture_h
+#define texture_h
+
+#include "utils/common.h"
+#include "utils/color.h"
+#include "physics/hittable.h"
+#include "render/texture_cache.h"
+
+
+class texture {
+public:
+    virtual ~texture() = default;
+
+    virtual color value(const hit_record& rec) const = 0;
+};
+
+
+class solid_color : public texture {
+private:
+    color albedo;
+
+public:
+    solid_color(const color& albedo) : albedo(albedo) {}
+
+    color value(const hit_record& rec) const override {
+        return albedo;
+    }
+};
+
+
+// ----------------------------------------------------- //
+// image_texture
+// ----------------------------------------------------- //
+// a tiled texture file (render/texture_cache.h), sampled through shared_texture_cache()
+// the mip level comes from the ray's footprint at the hit: footprint / du is how much of one
+// u unit the pixel covers, times the width in texels -- trilinear between the two levels
+// around it. (u, v) repeat outside [0, 1], v = 0 is the bottom row of the image
+
+class image_texture : public texture {
+private:
+    shared_ptr<texture_file> file;
+
+public:
+    explicit image_texture(const std::string& path) : file(make_shared<texture_file>(path)) {}
+
+    color value(const hit_record& rec) const override {
+        if (!file->valid()) {
+            // debugging aid -- cyan for a missing texture
+            return color(0, 1, 1);
+        }
+
+        double lod = level_of_detail(rec);
+        int level = int(lod);
+        double blend = lod - level;
+
+        color c = bilinear(level, rec.u, rec.v);
+        if (blend > 0 && level + 1 < file->level_count()) {
+            c = (1 - blend) * c + blend * bilinear(level + 1, rec.u, rec.v);
+        }
+        return c;
+    }
+
+private:
+    double level_of_detail(const hit_record& rec) const {
+        const texture_level& base = file->level(0);
+        double texels = 0;
+        if (rec.du > 0) texels = std::fmax(texels, rec.footprint / rec.du * base.width);
+        if (rec.dv > 0) texels = std::fmax(texels, rec.footprint / rec.dv * base.height);
+
+        // less than a texel per pixel is level 0
+        double lod = texels > 1 ? std::log2(texels) : 0;
+        return std::fmin(lod, double(file->level_count() - 1));
+    }
+
+    color bilinear(int level, double u, double v) const {
+        const texture_level& lv = file->level(level);
+        double x = (u - std::floor(u)) * lv.width - 0.5;
+        double y = (1 - (v - std::floor(v))) * lv.height - 0.5;
+
+        double fx = std::floor(x), fy = std::floor(y);
+        double wx = x - fx, wy = y - fy;
+        int x0 = wrap(int(fx), lv.width), x1 = wrap(int(fx) + 1, lv.width);
+        int y0 = wrap(int(fy), lv.height), y1 = wrap(int(fy) + 1, lv.height);
+
+        return (1 - wy) * ((1 - wx) * texel(level, x0, y0) + wx * texel(level, x1, y0))
+             + wy * ((1 - wx) * texel(level, x0, y1) + wx * texel(level, x1, y1));
+    }
+
+    color texel(int level, int x, int y) const {
+        int size = file->tile_size();
+        shared_ptr<const texture_tile> tile = shared_texture_cache().tile(*file, level, x / size, y / size);
+        if (tile == nullptr) {
+            return color(0, 1, 1);
+        }
+
+        const uint8_t* rgb = &(*tile)[(size_t(y % size) * size + x % size) * 3];
+        return color(byte_to_linear(rgb[0]), byte_to_linear(rgb[1]), byte_to_linear(rgb[2]));
+    }
+
+    static int wrap(int i, uint32_t size) {
+        int n = int(size);
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    static double byte_to_linear(uint8_t value) {
+        // inverse of color_to_bytes' gamma 2
+        static const std::vector<double> table = []() {
+            std::vector<double> t(256);
+            for (int i = 0; i < 256; i++) t[i] = (i / 255.0) * (i / 255.0);
+            return t;
+        }();
+        return table[value];
+    }
+};
+
+
+#endif
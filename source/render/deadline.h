@@ -0,0 +1,189 @@
+
+#ifndef deadline_h
+#define deadline_h
+
+#include "utils/common.h"
+#include "utils/color.h"
+#include "math/area.h"
+#include "render/framebuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+
+
+// ----------------------------------------------------- //
+// deadline rendering
+// ----------------------------------------------------- //
+// the render gets a wall clock budget instead of a sample count. it runs in rounds, each round
+// gives every tile at most one job (more samples for that tile):
+//     round 0     : deadline_calibration_samples everywhere -- measures throughput. always
+//                   finished, so a budget too short for it runs over instead of leaving black tiles
+//     round 1 ... : about half the time that is left, spread over the tiles by their noise
+// workers skip later jobs that would not finish before the deadline, so every tile always holds
+// a whole number of samples (at least one) for each of its pixels -- the image is normalized
+// whenever it stops
+
+struct deadline_job {
+    area2d tile;
+    int tile_index;
+    int first_sample;           // samples the tile already has
+    int sample_count;           // per pixel
+    double predicted_seconds;   // wall time, with every worker busy -- 0 if unknown
+    int done;                   // set by the worker -- read after the workers exit
+};
+
+struct deadline_tile {
+    area2d tile;
+    int samples;                // per pixel, finished
+    double error;               // relative standard error of the tile's pixels (higher first)
+
+    int pixel_count() const { return (tile.max_x - tile.min_x) * (tile.max_y - tile.min_y); }
+};
+
+
+// ----------------------------------------------------- //
+// deadline_queue
+// ----------------------------------------------------- //
+// one round of jobs, MAP_SHARED -- forked workers take the next one with an atomic counter
+
+class deadline_queue {
+private:
+    struct shared_block {
+        std::atomic<uint32_t> next;
+        uint32_t count;
+    };
+
+    shared_block* block;
+    deadline_job* jobs;
+    size_t capacity;
+
+public:
+    explicit deadline_queue(size_t capacity) : block(nullptr), jobs(nullptr), capacity(capacity) {
+        void* memory = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: deadline job queue allocation failed" << std::endl;
+            return;
+        }
+        block = new (memory) shared_block();
+        block->next.store(0);
+        block->count = 0;
+        jobs = reinterpret_cast<deadline_job*>(static_cast<char*>(memory) + sizeof(shared_block));
+    }
+
+    ~deadline_queue() {
+        if (block != nullptr) munmap(block, bytes());
+    }
+
+    deadline_queue(const deadline_queue&) = delete;
+    deadline_queue& operator=(const deadline_queue&) = delete;
+
+    bool valid() const { return block != nullptr; }
+
+    // parent, before forking the round's workers
+    void reset(const std::vector<deadline_job>& round) {
+        size_t count = std::min(round.size(), capacity);
+        std::copy(round.begin(), round.begin() + count, jobs);
+        block->count = uint32_t(count);
+        block->next.store(0);
+    }
+
+    // workers -- null once every job was handed out
+    deadline_job* next() {
+        uint32_t i = block->next.fetch_add(1, std::memory_order_relaxed);
+        return i < block->count ? &jobs[i] : nullptr;
+    }
+
+    size_t size() const { return block->count; }
+    const deadline_job& operator[](size_t i) const { return jobs[i]; }
+
+private:
+    size_t bytes() const { return sizeof(shared_block) + std::max<size_t>(1, capacity) * sizeof(deadline_job); }
+};
+
+
+// ----------------------------------------------------- //
+// round planning
+// ----------------------------------------------------- //
+
+// mean relative standard error over the tile -- needs the framebuffer's variance buffer
+// dark pixels are measured against a floor, so black noise does not dominate. a single sample
+// has no variance yet -- those tiles count as 100% error
+inline double tile_error(const framebuffer& fb, const area2d& tile, int samples) {
+    if (samples < 2) {
+        return 1;
+    }
+
+    const float* variance = fb.variance_data();
+    const float* rgb = fb.color_data();
+    double sum = 0;
+    for (int y = tile.min_y; y < tile.max_y; y++) {
+        for (int x = tile.min_x; x < tile.max_x; x++) {
+            size_t i = fb.index(x, y);
+            double mean = luminance(color(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]));
+            sum += std::sqrt(std::max(0.0, double(variance[i]))) / (std::fabs(mean) + 0.05);
+        }
+    }
+    int pixels = (tile.max_x - tile.min_x) * (tile.max_y - tile.min_y);
+    return pixels > 0 ? sum / pixels : 0;
+}
+
+// splits `pixel_samples` over the tiles in proportion to error * pixels, noisiest tiles first
+// a tile gets at most `max_job_pixel_samples` (keeps jobs short next to the deadline) and never
+// more than max_samples per pixel in total
+inline std::vector<deadline_job> plan_deadline_round(const std::vector<deadline_tile>& tiles, double pixel_samples,
+                                                     int max_samples, double max_job_pixel_samples, double seconds_per_sample) {
+    std::vector<int> order;
+    double total_weight = 0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        if (tiles[i].samples < max_samples && tiles[i].error > 0) {
+            order.push_back(int(i));
+            total_weight += tiles[i].error * tiles[i].pixel_count();
+        }
+    }
+    std::sort(order.begin(), order.end(), [&tiles](int a, int b) { return tiles[a].error > tiles[b].error; });
+
+    std::vector<deadline_job> jobs;
+    double left = pixel_samples;
+    for (int i : order) {
+        const deadline_tile& t = tiles[i];
+        double share = pixel_samples * t.error * t.pixel_count() / total_weight;
+        int count = int(std::min(share, max_job_pixel_samples) / t.pixel_count());
+
+        // whatever rounding leaves over goes to the noisiest tiles, one sample at a time
+        if (count == 0 && left >= t.pixel_count()) count = 1;
+        count = std::min(count, max_samples - t.samples);
+        if (count <= 0 || left < double(count) * t.pixel_count()) {
+            continue;
+        }
+
+        left -= double(count) * t.pixel_count();
+        jobs.push_back({t.tile, i, t.samples, count, double(count) * t.pixel_count() * seconds_per_sample, 0});
+    }
+    return jobs;
+}
+
+// achieved samples per pixel of every tile, one line per row of tiles
+inline bool write_deadline_report(const std::string& path, const std::vector<deadline_tile>& tiles, int tiles_x) {
+    std::ofstream output(path);
+    if (!output.is_open()) {
+        std::cerr << "Error: deadline report failed to open: " << path << std::endl;
+        return false;
+    }
+
+    output << "# samples per pixel of each " << (tiles.empty() ? 0 : tiles[0].tile.max_x - tiles[0].tile.min_x)
+           << " pixel tile, top row first" << std::endl;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        output << tiles[i].samples << ((i + 1) % tiles_x == 0 ? '\n' : ' ');
+    }
+    return bool(output);
+}
+
+
+#endif
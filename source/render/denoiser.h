@@ -0,0 +1,191 @@
+
+#ifndef denoiser_h
+#define denoiser_h
+
+#include "utils/common.h"
+#include "render/framebuffer.h"
+
+#include <thread>
+
+
+// ----------------------------------------------------- //
+// denoiser
+// ----------------------------------------------------- //
+// edge-avoiding a-trous wavelet filter (dammertz et al. 2010, with the variance guided
+// luminance weight from svgf)
+// each pass is a 5x5 b3-spline kernel with holes of 2^i pixels -- neighbors are weighted by
+// how similar their normal, albedo, depth and luminance are to the center pixel
+//
+// the filter runs on demodulated color (color / albedo) so texture detail from the albedo
+// buffer survives, then multiplies the albedo back in
+
+class denoiser {
+public:
+    int iterations = 5;             // kernel reaches 2^iterations * 2 pixels wide
+    double sigma_luminance = 4.0;   // in standard deviations of the pixel's noise
+    double sigma_normal = 64.0;     // exponent on dot(n_p, n_q)
+    double sigma_albedo = 0.1;
+    double sigma_depth = 0.05;      // relative to the larger of the two depths
+    int thread_count = 0;           // 0 -> std::thread::hardware_concurrency()
+
+    // writes the filtered image into `output` (3 floats per pixel)
+    void run(const framebuffer& fb, std::vector<float>& output) const {
+        const int width = fb.width();
+        const int height = fb.height();
+        const size_t pixels = size_t(width) * height;
+
+        output.assign(fb.color_data(), fb.color_data() + pixels * 3);
+        if (!fb.has_aovs()) {
+            std::cerr << "Error: denoiser needs albedo / normal / depth buffers" << std::endl;
+            return;
+        }
+
+        // demodulate -- the variance is scaled along with the color
+        const float* albedo = fb.albedo_data();
+        std::vector<float> current(pixels * 4);
+        for (size_t i = 0; i < pixels; i++) {
+            float a[3];
+            for (int c = 0; c < 3; c++) {
+                a[c] = std::max(albedo[i * 3 + c], 1e-3f);
+                current[i * 4 + c] = output[i * 3 + c] / a[c];
+            }
+            float a_luminance = float(luminance(color(a[0], a[1], a[2])));
+            current[i * 4 + 3] = fb.variance_data()[i] / (a_luminance * a_luminance);
+        }
+        std::vector<float> next(pixels * 4);
+
+        int threads = thread_count > 0 ? thread_count : int(std::thread::hardware_concurrency());
+        threads = std::max(1, std::min(threads, height));
+
+        for (int pass = 0; pass < iterations; pass++) {
+            int step = 1 << pass;
+
+            // split rows across threads -- every pass reads `current` and writes `next`
+            std::vector<std::thread> workers;
+            workers.reserve(threads);
+            for (int t = 0; t < threads; t++) {
+                int min_y = (height * t) / threads;
+                int max_y = (height * (t + 1)) / threads;
+                workers.emplace_back([this, &fb, &current, &next, step, min_y, max_y]() {
+                    filter_rows(fb, current.data(), next.data(), step, min_y, max_y);
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            current.swap(next);
+        }
+
+        // remodulate
+        for (size_t i = 0; i < pixels; i++) {
+            for (int c = 0; c < 3; c++) {
+                output[i * 3 + c] = current[i * 4 + c] * std::max(albedo[i * 3 + c], 1e-3f);
+            }
+        }
+    }
+
+private:
+    // `in` / `out` hold 4 floats per pixel -- demodulated rgb + luminance variance
+    void filter_rows(const framebuffer& fb, const float* in, float* out, int step, int min_y, int max_y) const {
+        static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+        const int width = fb.width();
+        const int height = fb.height();
+        const float* albedo = fb.albedo_data();
+        const float* normal = fb.normal_data();
+        const float* depth = fb.depth_data();
+
+        const float inv_a = float(1.0 / (sigma_albedo * sigma_albedo));
+        const float inv_d = float(1.0 / sigma_depth);
+
+        for (int y = min_y; y < max_y; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t p = size_t(y) * width + x;
+                const float* cp = in + p * 4;
+                const float* ap = albedo + p * 3;
+                const float* np = normal + p * 3;
+                float dp = depth[p];
+                float lp = float(luminance(color(cp[0], cp[1], cp[2])));
+
+                // the luminance edge stop widens with the noise level of the center pixel
+                float sigma_l = float(sigma_luminance) * std::sqrt(blurred_variance(in, width, height, x, y)) + 1e-4f;
+
+                float sum[4] = {0, 0, 0, 0};
+                float weight_sum = 0;
+
+                for (int ky = -2; ky <= 2; ky++) {
+                    int qy = y + ky * step;
+                    if (qy < 0 || qy >= height) continue;
+
+                    for (int kx = -2; kx <= 2; kx++) {
+                        int qx = x + kx * step;
+                        if (qx < 0 || qx >= width) continue;
+
+                        size_t q = size_t(qy) * width + qx;
+                        const float* cq = in + q * 4;
+                        const float* aq = albedo + q * 3;
+                        const float* nq = normal + q * 3;
+                        float lq = float(luminance(color(cq[0], cq[1], cq[2])));
+
+                        float n_dot = np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2];
+                        float w_n = std::pow(std::max(0.0f, n_dot), float(sigma_normal));
+                        if (np[0] == 0 && np[1] == 0 && np[2] == 0 && nq[0] == 0 && nq[1] == 0 && nq[2] == 0) {
+                            w_n = 1;        // both missed the scene
+                        }
+
+                        float da = squared_distance(ap, aq);
+                        float dd = std::fabs(dp - depth[q]) / (std::max(dp, depth[q]) + 1e-4f);
+                        float dl = std::fabs(lp - lq) / sigma_l;
+
+                        float w = kernel[kx + 2] * kernel[ky + 2] * w_n * std::exp(-da * inv_a - dd * inv_d - dl);
+
+                        sum[0] += w * cq[0];
+                        sum[1] += w * cq[1];
+                        sum[2] += w * cq[2];
+                        sum[3] += w * w * cq[3];
+                        weight_sum += w;
+                    }
+                }
+
+                // the center pixel always contributes, so weight_sum > 0
+                float* o = out + p * 4;
+                o[0] = sum[0] / weight_sum;
+                o[1] = sum[1] / weight_sum;
+                o[2] = sum[2] / weight_sum;
+                o[3] = sum[3] / (weight_sum * weight_sum);
+            }
+        }
+    }
+
+    static float blurred_variance(const float* in, int width, int height, int x, int y) {
+        // 3x3 gaussian of the variance -- a single pixel's estimate is too noisy at low spp
+        static const float kernel[3] = {0.25f, 0.5f, 0.25f};
+
+        float sum = 0;
+        float weight_sum = 0;
+        for (int ky = -1; ky <= 1; ky++) {
+            int qy = y + ky;
+            if (qy < 0 || qy >= height) continue;
+            for (int kx = -1; kx <= 1; kx++) {
+                int qx = x + kx;
+                if (qx < 0 || qx >= width) continue;
+
+                float w = kernel[kx + 1] * kernel[ky + 1];
+                sum += w * in[(size_t(qy) * width + qx) * 4 + 3];
+                weight_sum += w;
+            }
+        }
+        return std::max(sum / weight_sum, 0.0f);
+    }
+
+    static float squared_distance(const float* a, const float* b) {
+        float dx = a[0] - b[0];
+        float dy = a[1] - b[1];
+        float dz = a[2] - b[2];
+        return dx * dx + dy * dy + dz * dz;
+    }
+};
+
+
+#endif
@@ -0,0 +1,445 @@
+
+#ifndef distributed_h
+#define distributed_h
+
+#include "utils/common.h"
+#include "math/area.h"
+#include "render/framebuffer.h"
+#include "render/progress.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+
+// ----------------------------------------------------- //
+// sockets
+// ----------------------------------------------------- //
+// addresses are "unix:/path/to/socket" or "tcp:host:port"
+// an empty host listens on every interface ("tcp::7000") and connects to localhost
+
+#ifdef MSG_NOSIGNAL
+const int socket_send_flags = MSG_NOSIGNAL;
+#else
+const int socket_send_flags = 0;           // macos -- SO_NOSIGPIPE is set on the socket instead
+#endif
+
+inline void socket_no_sigpipe(int fd) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+inline bool split_tcp_address(const std::string& address, std::string& host, std::string& port) {
+    // "tcp:host:port" -- the port is after the last colon
+    size_t last = address.rfind(':');
+    if (address.compare(0, 4, "tcp:") != 0 || last < 4) {
+        return false;
+    }
+    host = address.substr(4, last - 4);
+    port = address.substr(last + 1);
+    return !port.empty();
+}
+
+inline bool unix_address(const std::string& address, sockaddr_un& addr) {
+    if (address.compare(0, 5, "unix:") != 0) {
+        return false;
+    }
+    std::string path = address.substr(5);
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+// -1 on failure
+inline int listen_on(const std::string& address) {
+    sockaddr_un local;
+    if (unix_address(address, local)) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        unlink(local.sun_path);         // left over from an earlier run
+        if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0 || listen(fd, 64) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host, port;
+    if (!split_tcp_address(address, host, port)) {
+        std::cerr << "Error: bad socket address " << address << " -- use unix:/path or tcp:host:port" << std::endl;
+        return -1;
+    }
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.empty() || host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        return -1;
+    }
+
+    int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    int on = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fd >= 0 && (bind(fd, found->ai_addr, found->ai_addrlen) < 0 || listen(fd, 64) < 0)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// retries for up to retry_seconds -- workers may start before the coordinator listens
+inline int connect_to(const std::string& address, double retry_seconds = 10.0) {
+    std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(int(retry_seconds * 1000));
+
+    while (true) {
+        int fd = -1;
+        sockaddr_un local;
+        std::string host, port;
+        if (unix_address(address, local)) {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        } else if (split_tcp_address(address, host, port)) {
+            addrinfo hints;
+            std::memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* found = nullptr;
+            if (getaddrinfo(host.empty() || host == "*" ? "localhost" : host.c_str(), port.c_str(), &hints, &found) == 0) {
+                for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next) {
+                    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+                        close(fd);
+                        fd = -1;
+                    }
+                }
+                freeaddrinfo(found);
+            }
+            if (fd >= 0) {
+                // results are written in one go -- don't hold the header back waiting for more
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+        } else {
+            std::cerr << "Error: bad socket address " << address << " -- use unix:/path or tcp:host:port" << std::endl;
+            return -1;
+        }
+
+        if (fd >= 0) {
+            socket_no_sigpipe(fd);
+            return fd;
+        }
+        if (std::chrono::steady_clock::now() >= give_up) {
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+inline bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, socket_send_flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+inline bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+
+// ----------------------------------------------------- //
+// tile_message
+// ----------------------------------------------------- //
+// worker -> coordinator: hello (once), then one result per job
+// coordinator -> worker: a job after every hello / result, or done
+// results carry payload_floats floats of framebuffer::pack_tile data right after the header
+// everything is sent in host byte order -- a render farm is expected to be one architecture
+
+enum tile_message_type : uint32_t { tile_hello = 1, tile_job = 2, tile_result = 3, tile_done = 4 };
+
+struct tile_message {
+    uint32_t type;
+    int32_t tile;               // job, result -- index into the coordinator's tile list
+    area2d area;                // job
+    uint64_t key;               // hello -- camera key, so a worker set up for another frame is turned away
+    uint32_t payload_floats;    // result
+    uint32_t pad;
+};
+
+inline bool send_message(int fd, const tile_message& message, const float* payload = nullptr) {
+    if (!write_all(fd, &message, sizeof(message))) return false;
+    return message.payload_floats == 0 || write_all(fd, payload, message.payload_floats * sizeof(float));
+}
+
+inline tile_message make_message(uint32_t type) {
+    tile_message message;
+    std::memset(&message, 0, sizeof(message));
+    message.type = type;
+    return message;
+}
+
+
+// ----------------------------------------------------- //
+// tile_coordinator
+// ----------------------------------------------------- //
+// hands tiles to whichever worker asks next and assembles the results into a framebuffer
+// a worker that disconnects has its tile put back in the queue; once the queue is empty, idle
+// workers also get a second copy of any tile that has run far longer than the average (a slow
+// or stuck worker) -- whichever copy finishes first is kept
+
+class tile_coordinator {
+private:
+    struct connection {
+        int fd;
+        std::vector<char> inbox;
+        bool greeted;
+        bool waiting;           // sent a hello / result, has no job
+        int tile;               // current job, -1 if none
+        std::chrono::steady_clock::time_point started;
+    };
+
+    uint64_t key;
+    std::vector<connection> connections;
+
+public:
+    double reassign_factor = 4.0;           // a job is duplicated after this many times the average tile time ...
+    double min_reassign_seconds = 1.0;      // ... but never sooner than this
+    double no_worker_timeout = 30.0;        // gives up if no worker is connected for this long
+
+    explicit tile_coordinator(uint64_t key) : key(key) {}
+
+    // blocks until every tile is in fb -- false if the workers went away for good
+    bool run(int listen_fd, const std::vector<area2d>& tiles, framebuffer& fb, progress_counters* progress, int samples_per_pixel) {
+        typedef std::chrono::steady_clock clock;
+
+        std::deque<int> pending;
+        for (size_t i = 0; i < tiles.size(); i++) pending.push_back(int(i));
+        std::vector<bool> done(tiles.size(), false);
+        size_t remaining = tiles.size();
+
+        double total_tile_seconds = 0;
+        int finished_jobs = 0;
+        clock::time_point last_worker_seen = clock::now();
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+        while (remaining > 0) {
+            // ----- hand out work ----- //
+            double average = finished_jobs > 0 ? total_tile_seconds / finished_jobs : 0;
+            double reassign_after = std::max(min_reassign_seconds, reassign_factor * average);
+            for (connection& c : connections) {
+                if (!c.waiting) continue;
+
+                while (!pending.empty() && done[pending.front()]) pending.pop_front();
+                int tile = -1;
+                if (!pending.empty()) {
+                    tile = pending.front();
+                    pending.pop_front();
+                } else {
+                    tile = find_straggler(done, reassign_after);
+                }
+                if (tile < 0) continue;
+
+                tile_message job = make_message(tile_job);
+                job.tile = tile;
+                job.area = tiles[tile];
+                if (!send_message(c.fd, job)) {
+                    pending.push_front(tile);
+                    continue;           // dropped on its next read
+                }
+                c.waiting = false;
+                c.tile = tile;
+                c.started = clock::now();
+            }
+
+            // ----- wait for results + new workers ----- //
+            std::vector<pollfd> fds(1 + connections.size());
+            fds[0].fd = listen_fd;
+            fds[0].events = POLLIN;
+            for (size_t i = 0; i < connections.size(); i++) {
+                fds[i + 1].fd = connections[i].fd;
+                fds[i + 1].events = POLLIN;
+            }
+            poll(fds.data(), fds.size(), 100);
+
+            if (fds[0].revents & POLLIN) {
+                accept_workers(listen_fd);
+            }
+
+            for (size_t i = 0; i < connections.size(); i++) {
+                connection& c = connections[i];
+                bool alive = true;
+                if (i + 1 < fds.size() && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    alive = receive(c);
+                }
+
+                // complete messages in the inbox
+                while (alive && c.inbox.size() >= sizeof(tile_message)) {
+                    tile_message message;
+                    std::memcpy(&message, c.inbox.data(), sizeof(message));
+                    size_t length = sizeof(message) + size_t(message.payload_floats) * sizeof(float);
+                    if (c.inbox.size() < length) break;
+
+                    if (message.type == tile_hello) {
+                        alive = message.key == key;
+                        if (!alive) {
+                            std::cerr << "Warning: worker rendering a different camera -- turned away" << std::endl;
+                            send_message(c.fd, make_message(tile_done));
+                        }
+                        c.greeted = true;
+                        c.waiting = true;
+                    } else if (message.type == tile_result && c.greeted && message.tile == c.tile
+                               && message.tile >= 0 && size_t(message.tile) < tiles.size()) {
+                        const area2d& area = tiles[message.tile];
+                        bool complete = message.payload_floats == fb.tile_floats(area);
+                        if (complete && !done[message.tile]) {
+                            const float* payload = reinterpret_cast<const float*>(c.inbox.data() + sizeof(message));
+                            fb.unpack_tile(area, payload);
+                            done[message.tile] = true;
+                            remaining--;
+                            if (progress != nullptr) {
+                                uint64_t pixels = uint64_t(area.max_x - area.min_x) * (area.max_y - area.min_y);
+                                progress->add(pixels, pixels * samples_per_pixel);
+                            }
+                        }
+                        total_tile_seconds += std::chrono::duration<double>(clock::now() - c.started).count();
+                        finished_jobs++;
+                        c.tile = -1;
+                        c.waiting = true;
+                        alive = complete;
+                    } else {
+                        alive = false;      // protocol error
+                    }
+                    c.inbox.erase(c.inbox.begin(), c.inbox.begin() + length);
+                }
+
+                if (!alive) {
+                    // its job goes back to the front of the queue
+                    if (c.tile >= 0 && !done[c.tile]) pending.push_front(c.tile);
+                    close(c.fd);
+                    c.fd = -1;
+                }
+            }
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [](const connection& c) { return c.fd < 0; }), connections.end());
+
+            if (!connections.empty()) {
+                last_worker_seen = clock::now();
+            } else if (std::chrono::duration<double>(clock::now() - last_worker_seen).count() > no_worker_timeout) {
+                std::cerr << "Error: no workers connected for " << no_worker_timeout << " s -- "
+                          << remaining << " tiles left" << std::endl;
+                return false;
+            }
+        }
+
+        // everyone still connected can stop -- late copies of duplicated tiles are dropped
+        for (connection& c : connections) {
+            send_message(c.fd, make_message(tile_done));
+            close(c.fd);
+        }
+        connections.clear();
+        return true;
+    }
+
+private:
+    void accept_workers(int listen_fd) {
+        while (true) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) return;
+
+            socket_no_sigpipe(fd);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));     // fails harmlessly on unix sockets
+
+            connection c;
+            c.fd = fd;
+            c.greeted = false;
+            c.waiting = false;
+            c.tile = -1;
+            connections.push_back(c);
+        }
+    }
+
+    // false once the worker is gone
+    static bool receive(connection& c) {
+        char buffer[65536];
+        while (true) {
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                c.inbox.insert(c.inbox.end(), buffer, buffer + n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+    // oldest running tile past the deadline that no more than one worker has -- -1 if none
+    int find_straggler(const std::vector<bool>& done, double reassign_after) const {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int best = -1;
+        double best_age = reassign_after;
+        for (const connection& c : connections) {
+            if (c.tile < 0 || done[c.tile]) continue;
+
+            double age = std::chrono::duration<double>(now - c.started).count();
+            if (age > best_age && copies(c.tile) < 2) {
+                best = c.tile;
+                best_age = age;
+            }
+        }
+        return best;
+    }
+
+    int copies(int tile) const {
+        int count = 0;
+        for (const connection& c : connections) {
+            if (c.tile == tile) count++;
+        }
+        return count;
+    }
+};
+
+
+#endif
@@ -0,0 +1,486 @@
+
+#ifndef encoders_h
+#define encoders_h
+
+#include "utils/common.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+
+// ----------------------------------------------------- //
+// image encoders
+// ----------------------------------------------------- //
+// 8 bit rgb images, fed a few rows at a time (top to bottom) -- each add_rows call writes its
+// output to the file straight away, so an image can be encoded while the rest still renders
+//     encoder->open(path, width, height)  ->  add_rows(rgb, rows) ...  ->  finish()
+
+class image_encoder {
+public:
+    virtual ~image_encoder() = default;
+
+    virtual bool open(const std::string& path, int width, int height) = 0;
+    virtual bool add_rows(const uint8_t* rgb, int rows) = 0;
+    virtual bool finish() = 0;
+};
+
+enum class image_format { ppm, png, qoi };
+
+inline const char* image_format_extension(image_format format) {
+    switch (format) {
+        case image_format::png: return ".png";
+        case image_format::qoi: return ".qoi";
+        default:                return ".ppm";
+    }
+}
+
+inline void put_u32_be(std::string& out, uint32_t value) {
+    out.push_back(char(value >> 24));
+    out.push_back(char(value >> 16));
+    out.push_back(char(value >> 8));
+    out.push_back(char(value));
+}
+
+
+// ----------------------------------------------------- //
+// ppm_encoder
+// ----------------------------------------------------- //
+// binary P6 -- same bytes as write_ppm's P3, a third of the size
+
+class ppm_encoder : public image_encoder {
+private:
+    std::ofstream output;
+    int width = 0;
+
+public:
+    bool open(const std::string& path, int w, int h) override {
+        width = w;
+        output.open(path, std::ios::binary);
+        output << "P6\n" << w << ' ' << h << "\n255\n";
+        return bool(output);
+    }
+
+    bool add_rows(const uint8_t* rgb, int rows) override {
+        output.write(reinterpret_cast<const char*>(rgb), std::streamsize(size_t(width) * rows * 3));
+        return bool(output);
+    }
+
+    bool finish() override {
+        output.close();
+        return !output.fail();
+    }
+};
+
+
+// ----------------------------------------------------- //
+// deflate_stream
+// ----------------------------------------------------- //
+// rfc 1951 deflate with lz77 (hash chains) + the fixed huffman code -- no dynamic tables, so
+// every write() can end its block and hand its bytes out without waiting for the rest of the
+// stream. matches reach back into earlier writes (32 kb window)
+
+class deflate_stream {
+private:
+    static const int window_size = 32768;
+    static const int hash_bits = 15;
+    static const int max_chain = 48;
+    static const int min_match = 3;
+    static const int max_match = 258;
+
+    std::vector<uint8_t> data;          // window + pending input, data[0] is stream position `base`
+    size_t base = 0;
+    size_t position = 0;                // next stream position to compress
+    std::vector<int64_t> head;          // hash -> last stream position with that hash
+    std::vector<int64_t> previous;      // position % window -> the position before it with the same hash
+
+    std::string out;
+    uint32_t bit_buffer = 0;
+    int bit_count = 0;
+
+public:
+    deflate_stream() : head(size_t(1) << hash_bits, -1), previous(window_size, -1) {}
+
+    // compresses `size` more bytes as one block, returns the bytes that are complete
+    std::string write(const uint8_t* input, size_t size) {
+        data.insert(data.end(), input, input + size);
+
+        put_bits(0, 1);                 // not final
+        put_bits(1, 2);                 // fixed huffman
+        size_t end = base + data.size();
+        while (position < end) {
+            int distance = 0;
+            int length = find_match(end, distance);
+            if (length >= min_match) {
+                put_length(length);
+                put_distance(distance);
+                for (int i = 0; i < length; i++) insert_hash(position++, end);
+            } else {
+                put_literal(byte_at(position));
+                insert_hash(position++, end);
+            }
+        }
+        put_literal(256);               // end of block
+        trim();
+
+        return take_output();
+    }
+
+    // final empty block + byte alignment
+    std::string finish() {
+        put_bits(1, 1);
+        put_bits(1, 2);
+        put_literal(256);
+        if (bit_count > 0) put_bits(0, 8 - bit_count);
+        return take_output();
+    }
+
+private:
+    uint8_t byte_at(size_t pos) const { return data[pos - base]; }
+
+    uint32_t hash_at(size_t pos) const {
+        uint32_t v = uint32_t(byte_at(pos)) << 16 | uint32_t(byte_at(pos + 1)) << 8 | byte_at(pos + 2);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    }
+
+    void insert_hash(size_t pos, size_t end) {
+        if (pos + min_match > end) return;
+        uint32_t h = hash_at(pos);
+        previous[pos % window_size] = head[h];
+        head[h] = int64_t(pos);
+    }
+
+    int find_match(size_t end, int& distance) const {
+        if (position + min_match > end) return 0;
+
+        int limit = int(std::min<size_t>(max_match, end - position));
+        int best = 0;
+        int64_t candidate = head[hash_at(position)];
+        for (int chain = 0; chain < max_chain && candidate >= int64_t(base); chain++) {
+            size_t dist = position - size_t(candidate);
+            if (dist > size_t(window_size) || dist == 0) break;
+
+            const uint8_t* a = &data[size_t(candidate) - base];
+            const uint8_t* b = &data[position - base];
+            if (a[best] == b[best]) {
+                int length = 0;
+                while (length < limit && a[length] == b[length]) length++;
+                if (length > best) {
+                    best = length;
+                    distance = int(dist);
+                    if (best == limit) break;
+                }
+            }
+            int64_t next = previous[size_t(candidate) % window_size];
+            if (next >= candidate) break;       // slot reused by a newer position
+            candidate = next;
+        }
+        return best;
+    }
+
+    void trim() {
+        // keep one window of history
+        if (data.size() > size_t(2 * window_size)) {
+            size_t drop = data.size() - window_size;
+            data.erase(data.begin(), data.begin() + drop);
+            base += drop;
+        }
+    }
+
+    // ----- bits ----- //
+
+    void put_bits(uint32_t value, int count) {
+        bit_buffer |= value << bit_count;
+        bit_count += count;
+        while (bit_count >= 8) {
+            out.push_back(char(bit_buffer & 0xff));
+            bit_buffer >>= 8;
+            bit_count -= 8;
+        }
+    }
+
+    // huffman codes go most significant bit first
+    void put_code(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put_bits(reversed, length);
+    }
+
+    void put_literal(int symbol) {
+        if (symbol < 144)      put_code(0x30 + symbol, 8);
+        else if (symbol < 256) put_code(0x190 + symbol - 144, 9);
+        else if (symbol < 280) put_code(symbol - 256, 7);
+        else                   put_code(0xc0 + symbol - 280, 8);
+    }
+
+    void put_length(int length) {
+        static const int base_length[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        int code = 28;
+        while (base_length[code] > length) code--;
+        put_literal(257 + code);
+        put_bits(uint32_t(length - base_length[code]), extra[code]);
+    }
+
+    void put_distance(int distance) {
+        static const int base_distance[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                              257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                              8193, 12289, 16385, 24577};
+        int code = 29;
+        while (base_distance[code] > distance) code--;
+        put_code(uint32_t(code), 5);
+        put_bits(uint32_t(distance - base_distance[code]), code < 4 ? 0 : code / 2 - 1);
+    }
+
+    std::string take_output() {
+        std::string result;
+        result.swap(out);
+        return result;
+    }
+};
+
+
+// ----------------------------------------------------- //
+// png_encoder
+// ----------------------------------------------------- //
+// rgb8, one IDAT chunk per add_rows call. rows are filtered with whichever of the five png
+// filters gives the smallest sum of absolute differences (the usual heuristic)
+
+class png_encoder : public image_encoder {
+private:
+    std::ofstream output;
+    int width = 0;
+    std::vector<uint8_t> previous_row;
+    deflate_stream deflater;
+    uint32_t adler_a = 1, adler_b = 0;
+    bool header_pending = true;
+
+public:
+    bool open(const std::string& path, int w, int h) override {
+        width = w;
+        previous_row.assign(size_t(w) * 3, 0);
+        output.open(path, std::ios::binary);
+        output.write("\x89PNG\r\n\x1a\n", 8);
+
+        std::string ihdr;
+        put_u32_be(ihdr, uint32_t(w));
+        put_u32_be(ihdr, uint32_t(h));
+        ihdr += std::string("\x08\x02\x00\x00\x00", 5);      // 8 bit, rgb, deflate, adaptive filters, no interlace
+        write_chunk("IHDR", ihdr);
+        return bool(output);
+    }
+
+    bool add_rows(const uint8_t* rgb, int rows) override {
+        size_t stride = size_t(width) * 3;
+        std::vector<uint8_t> filtered;
+        filtered.reserve((stride + 1) * rows);
+        for (int r = 0; r < rows; r++) {
+            filter_row(rgb + r * stride, filtered);
+            std::memcpy(previous_row.data(), rgb + r * stride, stride);
+        }
+        update_adler(filtered.data(), filtered.size());
+
+        std::string compressed;
+        if (header_pending) {
+            compressed = std::string("\x78\x01", 2);        // zlib header -- 32 kb window, no dictionary
+            header_pending = false;
+        }
+        compressed += deflater.write(filtered.data(), filtered.size());
+        write_chunk("IDAT", compressed);
+        return bool(output);
+    }
+
+    bool finish() override {
+        std::string tail;
+        if (header_pending) tail = std::string("\x78\x01", 2);
+        tail += deflater.finish();
+        put_u32_be(tail, (adler_b << 16) | adler_a);
+        write_chunk("IDAT", tail);
+        write_chunk("IEND", "");
+        output.close();
+        return !output.fail();
+    }
+
+private:
+    static uint8_t paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return uint8_t(a);
+        return uint8_t(pb <= pc ? b : c);
+    }
+
+    void filter_row(const uint8_t* row, std::vector<uint8_t>& out) const {
+        size_t stride = size_t(width) * 3;
+        const uint8_t* up = previous_row.data();
+
+        std::vector<uint8_t> candidates[5];
+        size_t best = 0;
+        long best_cost = -1;
+        for (int type = 0; type < 5; type++) {
+            std::vector<uint8_t>& f = candidates[type];
+            f.resize(stride);
+            long cost = 0;
+            for (size_t i = 0; i < stride; i++) {
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = up[i];
+                int c = i >= 3 ? up[i - 3] : 0;
+                int predicted = 0;
+                switch (type) {
+                    case 1: predicted = a; break;
+                    case 2: predicted = b; break;
+                    case 3: predicted = (a + b) / 2; break;
+                    case 4: predicted = paeth(a, b, c); break;
+                }
+                f[i] = uint8_t(row[i] - predicted);
+                cost += std::abs(int(int8_t(f[i])));
+            }
+            if (best_cost < 0 || cost < best_cost) {
+                best_cost = cost;
+                best = size_t(type);
+            }
+        }
+
+        out.push_back(uint8_t(best));
+        out.insert(out.end(), candidates[best].begin(), candidates[best].end());
+    }
+
+    void update_adler(const uint8_t* bytes, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            adler_a = (adler_a + bytes[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+
+    static std::vector<uint32_t> crc_table() {
+        std::vector<uint32_t> table(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }
+
+    static uint32_t crc32(const std::string& bytes, uint32_t crc = 0xffffffffu) {
+        static const std::vector<uint32_t> table = crc_table();
+        for (unsigned char byte : bytes) {
+            crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    void write_chunk(const char* type, const std::string& payload) {
+        std::string chunk;
+        put_u32_be(chunk, uint32_t(payload.size()));
+        std::string body = std::string(type, 4) + payload;
+        chunk += body;
+        put_u32_be(chunk, crc32(body) ^ 0xffffffffu);
+        output.write(chunk.data(), std::streamsize(chunk.size()));
+    }
+};
+
+
+// ----------------------------------------------------- //
+// qoi_encoder
+// ----------------------------------------------------- //
+// "quite ok image" format (qoiformat.org) -- runs, a 64 entry color cache and small deltas
+// to the previous pixel. far faster than png, somewhat larger
+
+class qoi_encoder : public image_encoder {
+private:
+    std::ofstream output;
+    int width = 0;
+    uint8_t cache[64][4];               // rgb + "set" -- the spec's cache starts as transparent black
+    uint8_t previous[3] = {0, 0, 0};
+    int run = 0;
+
+public:
+    bool open(const std::string& path, int w, int h) override {
+        width = w;
+        std::memset(cache, 0, sizeof(cache));
+        output.open(path, std::ios::binary);
+
+        std::string header = "qoif";
+        put_u32_be(header, uint32_t(w));
+        put_u32_be(header, uint32_t(h));
+        header.push_back(3);        // rgb
+        header.push_back(0);        // srgb with linear alpha
+        output.write(header.data(), std::streamsize(header.size()));
+        return bool(output);
+    }
+
+    bool add_rows(const uint8_t* rgb, int rows) override {
+        std::string out;
+        out.reserve(size_t(width) * rows * 2);
+        for (size_t i = 0; i < size_t(width) * rows; i++) {
+            encode_pixel(rgb + i * 3, out);
+        }
+        output.write(out.data(), std::streamsize(out.size()));
+        return bool(output);
+    }
+
+    bool finish() override {
+        std::string out;
+        if (run > 0) out.push_back(char(0xc0 | (run - 1)));
+        out += std::string(7, '\0') + "\x01";
+        output.write(out.data(), std::streamsize(out.size()));
+        output.close();
+        return !output.fail();
+    }
+
+private:
+    void encode_pixel(const uint8_t* p, std::string& out) {
+        if (p[0] == previous[0] && p[1] == previous[1] && p[2] == previous[2]) {
+            if (++run == 62) {
+                out.push_back(char(0xc0 | (run - 1)));
+                run = 0;
+            }
+            return;
+        }
+        if (run > 0) {
+            out.push_back(char(0xc0 | (run - 1)));
+            run = 0;
+        }
+
+        int index = (p[0] * 3 + p[1] * 5 + p[2] * 7 + 255 * 11) % 64;
+        if (cache[index][3] && cache[index][0] == p[0] && cache[index][1] == p[1] && cache[index][2] == p[2]) {
+            out.push_back(char(index));
+        } else {
+            std::memcpy(cache[index], p, 3);
+            cache[index][3] = 1;
+
+            int dr = int8_t(uint8_t(p[0] - previous[0]));
+            int dg = int8_t(uint8_t(p[1] - previous[1]));
+            int db = int8_t(uint8_t(p[2] - previous[2]));
+            int dr_dg = dr - dg, db_dg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back(char(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                out.push_back(char(0x80 | (dg + 32)));
+                out.push_back(char((dr_dg + 8) << 4 | (db_dg + 8)));
+            } else {
+                out.push_back(char(0xfe));
+                out.append(reinterpret_cast<const char*>(p), 3);
+            }
+        }
+        std::memcpy(previous, p, 3);
+    }
+};
+
+
+inline std::unique_ptr<image_encoder> make_encoder(image_format format) {
+    switch (format) {
+        case image_format::png: return std::unique_ptr<image_encoder>(new png_encoder());
+        case image_format::qoi: return std::unique_ptr<image_encoder>(new qoi_encoder());
+        default:                return std::unique_ptr<image_encoder>(new ppm_encoder());
+    }
+}
+
+
+#endif
@@ -0,0 +1,290 @@
+
+#ifndef framebuffer_h
+#define framebuffer_h
+
+#include "utils/common.h"
+#include "math/area.h"
+
+#include <fstream>
+#include <string>
+
+#include <sys/mman.h>
+
+
+// ----------------------------------------------------- //
+// aov_sample
+// ----------------------------------------------------- //
+// first hit data of a single camera sample (arbitrary output variables)
+
+struct aov_sample {
+    color albedo;
+    vec3 normal;
+    double depth;
+    bool hit;
+};
+
+
+// ----------------------------------------------------- //
+// framebuffer
+// ----------------------------------------------------- //
+// linear float image + optional first hit albedo / normal / depth buffers
+// (plus the per pixel variance of the color estimate, which the denoiser uses as its noise level)
+// memory is mapped MAP_SHARED so forked child processes write straight into the parent's buffers
+
+class framebuffer {
+private:
+    int _width;
+    int _height;
+    bool _has_aovs;
+
+    float* _block;
+    size_t _block_size;
+
+    float* _color;          // 3 floats per pixel -- averaged, linear radiance
+    float* _albedo;         // 3 floats per pixel
+    float* _normal;         // 3 floats per pixel -- world space, facing the camera
+    float* _depth;          // 1 float per pixel  -- distance to first hit, 0 if nothing was hit
+    float* _variance;       // 1 float per pixel  -- variance of the mean luminance
+
+public:
+    framebuffer(int width, int height, bool has_aovs)
+        : _width(width), _height(height), _has_aovs(has_aovs),
+          _block(nullptr), _block_size(0), _color(nullptr), _albedo(nullptr), _normal(nullptr), _depth(nullptr), _variance(nullptr) {
+
+        size_t pixels = size_t(width) * size_t(height);
+        size_t floats = pixels * (has_aovs ? 11 : 3);
+        _block_size = floats * sizeof(float);
+
+        void* memory = mmap(nullptr, _block_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: framebuffer allocation failed" << std::endl;
+            _block_size = 0;
+            return;
+        }
+        _block = static_cast<float*>(memory);
+
+        // anonymous mappings are zero filled
+        _color = _block;
+        if (has_aovs) {
+            _albedo = _color + pixels * 3;
+            _normal = _albedo + pixels * 3;
+            _depth = _normal + pixels * 3;
+            _variance = _depth + pixels;
+        }
+    }
+    ~framebuffer() {
+        if (_block != nullptr) {
+            munmap(_block, _block_size);
+        }
+    }
+
+    framebuffer(const framebuffer&) = delete;
+    framebuffer& operator=(const framebuffer&) = delete;
+
+    // ----------------------------------------------------- //
+    // logic
+    // ----------------------------------------------------- //
+
+    void set_color(int x, int y, const color& c) {
+        float* p = _color + index(x, y) * 3;
+        p[0] = float(c.x());
+        p[1] = float(c.y());
+        p[2] = float(c.z());
+    }
+
+    color get_color(int x, int y) const {
+        const float* p = _color + index(x, y) * 3;
+        return color(p[0], p[1], p[2]);
+    }
+
+    void set_aovs(int x, int y, const color& albedo, const vec3& normal, double depth, double variance) {
+        if (!_has_aovs) return;
+
+        size_t i = index(x, y);
+        float* a = _albedo + i * 3;
+        float* n = _normal + i * 3;
+        a[0] = float(albedo.x()); a[1] = float(albedo.y()); a[2] = float(albedo.z());
+        n[0] = float(normal.x()); n[1] = float(normal.y()); n[2] = float(normal.z());
+        _depth[i] = float(depth);
+        _variance[i] = float(variance);
+    }
+
+    void get_aovs(int x, int y, color& albedo, vec3& normal, double& depth, double& variance) const {
+        if (!_has_aovs) return;
+
+        size_t i = index(x, y);
+        const float* a = _albedo + i * 3;
+        const float* n = _normal + i * 3;
+        albedo = color(a[0], a[1], a[2]);
+        normal = vec3(n[0], n[1], n[2]);
+        depth = _depth[i];
+        variance = _variance[i];
+    }
+
+    // copies every buffer of one pixel to another
+    void copy_pixel(int from_x, int from_y, int to_x, int to_y) {
+        size_t from = index(from_x, from_y);
+        size_t to = index(to_x, to_y);
+        std::copy(_color + from * 3, _color + from * 3 + 3, _color + to * 3);
+        if (_has_aovs) {
+            std::copy(_albedo + from * 3, _albedo + from * 3 + 3, _albedo + to * 3);
+            std::copy(_normal + from * 3, _normal + from * 3 + 3, _normal + to * 3);
+            _depth[to] = _depth[from];
+            _variance[to] = _variance[from];
+        }
+    }
+
+    // ----------------------------------------------------- //
+    // tiles
+    // ----------------------------------------------------- //
+    // every buffer of a rectangle as one flat float array, row by row -- color, then (with aovs)
+    // albedo, normal, depth, variance of each pixel. used to send tiles between processes
+
+    size_t tile_floats(const area2d& area) const {
+        size_t pixels = size_t(area.max_x - area.min_x) * size_t(area.max_y - area.min_y);
+        return pixels * (_has_aovs ? 11 : 3);
+    }
+
+    void pack_tile(const area2d& area, std::vector<float>& out) const {
+        out.clear();
+        out.reserve(tile_floats(area));
+        for (int y = area.min_y; y < area.max_y; y++) {
+            for (int x = area.min_x; x < area.max_x; x++) {
+                size_t i = index(x, y);
+                out.insert(out.end(), _color + i * 3, _color + i * 3 + 3);
+                if (_has_aovs) {
+                    out.insert(out.end(), _albedo + i * 3, _albedo + i * 3 + 3);
+                    out.insert(out.end(), _normal + i * 3, _normal + i * 3 + 3);
+                    out.push_back(_depth[i]);
+                    out.push_back(_variance[i]);
+                }
+            }
+        }
+    }
+
+    void unpack_tile(const area2d& area, const float* in) {
+        for (int y = area.min_y; y < area.max_y; y++) {
+            for (int x = area.min_x; x < area.max_x; x++) {
+                size_t i = index(x, y);
+                std::copy(in, in + 3, _color + i * 3);
+                in += 3;
+                if (_has_aovs) {
+                    std::copy(in, in + 3, _albedo + i * 3);
+                    std::copy(in + 3, in + 6, _normal + i * 3);
+                    _depth[i] = in[6];
+                    _variance[i] = in[7];
+                    in += 8;
+                }
+            }
+        }
+    }
+
+    // ----------------------------------------------------- //
+    // getters
+    // ----------------------------------------------------- //
+    bool valid() const { return _block != nullptr; }
+    bool has_aovs() const { return _has_aovs; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    size_t index(int x, int y) const { return size_t(y) * _width + x; }
+
+    float* color_data() { return _color; }
+    const float* color_data() const { return _color; }
+    const float* albedo_data() const { return _albedo; }
+    const float* normal_data() const { return _normal; }
+    const float* depth_data() const { return _depth; }
+    const float* variance_data() const { return _variance; }
+};
+
+
+// ----------------------------------------------------- //
+// output
+// ----------------------------------------------------- //
+
+inline bool write_ppm(const std::string& path, const float* rgb, int width, int height) {
+    // rgb is linear -- write_color handles gamma + quantization
+    std::ofstream output(path);
+    if (!output.is_open()) {
+        std::cerr << "Error: output file failed to open: " << path << std::endl;
+        return false;
+    }
+
+    output << "P3" << std::endl << width << ' ' << height << std::endl << 255 << std::endl;
+    for (size_t i = 0; i < size_t(width) * height; i++) {
+        write_color(output, color(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]));
+    }
+    return true;
+}
+
+inline bool write_aovs(const std::string& base_path, const framebuffer& fb) {
+    // albedo as is, normals remapped from [-1, 1] to [0, 1], depth normalized by the farthest hit
+    if (!fb.has_aovs()) return false;
+
+    size_t pixels = size_t(fb.width()) * fb.height();
+    std::vector<float> normal(pixels * 3);
+    std::vector<float> depth(pixels * 3);
+
+    float max_depth = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        max_depth = std::max(max_depth, fb.depth_data()[i]);
+    }
+
+    for (size_t i = 0; i < pixels; i++) {
+        for (int c = 0; c < 3; c++) {
+            // write_color applies gamma 2 -- square here so the stored value is the plain remap
+            float n = 0.5f * (fb.normal_data()[i * 3 + c] + 1.0f);
+            normal[i * 3 + c] = n * n;
+            float d = (max_depth > 0) ? fb.depth_data()[i] / max_depth : 0.0f;
+            depth[i * 3 + c] = d * d;
+        }
+    }
+
+    return write_ppm(base_path + "-albedo.ppm", fb.albedo_data(), fb.width(), fb.height())
+        && write_ppm(base_path + "-normal.ppm", normal.data(), fb.width(), fb.height())
+        && write_ppm(base_path + "-depth.ppm", depth.data(), fb.width(), fb.height());
+}
+
+// false color ramp, blue (0) -> cyan -> green -> yellow -> red (1)
+inline color heat_color(double value) {
+    static const color ramp[] = {
+        color(0, 0, 1), color(0, 1, 1), color(0, 1, 0), color(1, 1, 0), color(1, 0, 0)
+    };
+    double x = std::min(std::max(value, 0.0), 1.0) * 4;
+    int i = std::min(int(x), 3);
+    double f = x - i;
+    return (1 - f) * ramp[i] + f * ramp[i + 1];
+}
+
+inline bool write_heatmaps(const std::string& base_path, const framebuffer& fb) {
+    // heatmap mode stores (nodes tested, primitives tested, 0) per camera ray in the color buffer
+    // each channel becomes its own image, scaled by its image wide maximum
+    size_t pixels = size_t(fb.width()) * fb.height();
+    const char* names[] = {"-nodes.ppm", "-primitives.ppm"};
+    const char* labels[] = {"nodes", "primitives"};
+
+    bool ok = true;
+    for (int channel = 0; channel < 2; channel++) {
+        double max_value = 0, sum = 0;
+        for (size_t i = 0; i < pixels; i++) {
+            max_value = std::max(max_value, double(fb.color_data()[i * 3 + channel]));
+            sum += fb.color_data()[i * 3 + channel];
+        }
+
+        std::vector<float> heat(pixels * 3);
+        for (size_t i = 0; i < pixels; i++) {
+            color c = heat_color(max_value > 0 ? fb.color_data()[i * 3 + channel] / max_value : 0);
+            for (int k = 0; k < 3; k++) {
+                // write_color applies gamma 2 -- square so the ramp is written as is
+                heat[i * 3 + k] = float(c[k] * c[k]);
+            }
+        }
+
+        std::cout << "Heatmap: " << (pixels > 0 ? sum / pixels : 0) << " " << labels[channel]
+                  << " tested per camera ray on average, " << max_value << " max" << std::endl;
+        ok = write_ppm(base_path + names[channel], heat.data(), fb.width(), fb.height()) && ok;
+    }
+    return ok;
+}
+
+
+#endif
@@ -0,0 +1,189 @@
+
+#ifndef hit_cache_h
+#define hit_cache_h
+
+#include "utils/common.h"
+#include "physics/hittable.h"
+#include "physics/closed_scene.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <sys/mman.h>
+
+
+// ----------------------------------------------------- //
+// cached_hit
+// ----------------------------------------------------- //
+// the first intersection of one camera sample
+// the camera ray itself is not stored -- it is regenerated from the sampler (cheap, and it keeps
+// the sampler dimensions in step), so the hit point is rebuilt exactly as ray.at(t)
+// neither is the material: it is looked up from the primitive on replay, so reassigning
+// materials between renders does not need a new cache
+
+struct cached_hit {
+    enum : int32_t { not_recorded = -2, missed = -1, hit = 0 };
+
+    double t;
+    int64_t primitive;          // index into closed_scene::primitives
+    float normal[3];            // facing the ray, as in hit_record
+    float uv[4];                // u, v, du, dv -- texture lookups
+    int32_t state;              // not_recorded, missed or hit
+    int32_t front_face;
+
+    void store(bool was_hit, const hit_record& rec) {
+        state = was_hit ? hit : missed;
+        if (!was_hit) {
+            return;
+        }
+        t = rec.t;
+        normal[0] = float(rec.normal.x());
+        normal[1] = float(rec.normal.y());
+        normal[2] = float(rec.normal.z());
+        uv[0] = float(rec.u);
+        uv[1] = float(rec.v);
+        uv[2] = float(rec.du);
+        uv[3] = float(rec.dv);
+        primitive = rec.primitive_id;
+        front_face = rec.front_face ? 1 : 0;
+    }
+
+    // false for samples the recording render never reached -- trace those instead
+    bool recorded() const { return state != not_recorded; }
+
+    // false if the camera ray missed
+    bool restore(const ray& r, const closed_scene& scene, hit_record& rec) const {
+        if (state != hit) {
+            return false;
+        }
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.normal = vec3(normal[0], normal[1], normal[2]);
+        rec.u = uv[0];
+        rec.v = uv[1];
+        rec.du = uv[2];
+        rec.dv = uv[3];
+        rec.front_face = front_face != 0;
+        rec.material_id = scene.primitive_material(primitive);
+        rec.primitive_id = primitive;
+        return true;
+    }
+};
+
+
+// ----------------------------------------------------- //
+// hit_cache
+// ----------------------------------------------------- //
+// one cached_hit per pixel sample -- recorded by a normal render, replayed by the next renders
+// as long as the camera + geometry keys match (materials may change freely)
+// memory is mapped MAP_SHARED so forked children record straight into the parent's copy
+// a render that did not reach every sample (deadline, remote workers, a strip) is not saved
+
+class hit_cache {
+private:
+    struct file_header {
+        char magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint32_t samples_per_pixel;
+        uint32_t record_size;
+        uint64_t camera_key;
+        uint64_t geometry_key;
+    };
+
+    file_header header;
+    cached_hit* records;
+    size_t record_count;
+
+public:
+    hit_cache(int width, int height, int samples_per_pixel, uint64_t camera_key, uint64_t geometry_key)
+        : records(nullptr), record_count(size_t(width) * height * samples_per_pixel) {
+
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "rthits2", 8);
+        header.width = uint32_t(width);
+        header.height = uint32_t(height);
+        header.samples_per_pixel = uint32_t(samples_per_pixel);
+        header.record_size = uint32_t(sizeof(cached_hit));
+        header.camera_key = camera_key;
+        header.geometry_key = geometry_key;
+
+        void* memory = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: hit cache allocation failed" << std::endl;
+            record_count = 0;
+            return;
+        }
+        records = static_cast<cached_hit*>(memory);
+        for (size_t i = 0; i < record_count; i++) {
+            records[i].state = cached_hit::not_recorded;
+        }
+    }
+    ~hit_cache() {
+        if (records != nullptr) {
+            munmap(records, bytes());
+        }
+    }
+
+    hit_cache(const hit_cache&) = delete;
+    hit_cache& operator=(const hit_cache&) = delete;
+
+    bool valid() const { return records != nullptr; }
+
+    bool complete() const {
+        for (size_t i = 0; i < record_count; i++) {
+            if (!records[i].recorded()) return false;
+        }
+        return true;
+    }
+
+    cached_hit* at(int x, int y, int sample) {
+        return records + (size_t(y) * header.width + x) * header.samples_per_pixel + sample;
+    }
+
+    // ----------------------------------------------------- //
+    // disk
+    // ----------------------------------------------------- //
+
+    // false if the file is missing or was recorded for another camera / geometry / resolution
+    bool load(const std::string& path) {
+        if (!valid()) return false;
+
+        std::ifstream input(path, std::ios::binary);
+        if (!input.is_open()) {
+            return false;
+        }
+
+        file_header stored;
+        input.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+        if (!input || std::memcmp(&stored, &header, sizeof(header)) != 0) {
+            return false;
+        }
+
+        input.read(reinterpret_cast<char*>(records), std::streamsize(bytes()));
+        return bool(input);
+    }
+
+    // false without writing if some samples were never recorded
+    bool save(const std::string& path) const {
+        if (!valid() || !complete()) return false;
+
+        std::ofstream output(path, std::ios::binary);
+        if (!output.is_open()) {
+            std::cerr << "Error: hit cache file failed to open: " << path << std::endl;
+            return false;
+        }
+
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(reinterpret_cast<const char*>(records), std::streamsize(bytes()));
+        return bool(output);
+    }
+
+private:
+    size_t bytes() const { return std::max<size_t>(1, record_count) * sizeof(cached_hit); }
+};
+
+
+#endif
@@ -0,0 +1,249 @@
+
+#ifndef image_writer_h
+#define image_writer_h
+
+#include "utils/common.h"
+#include "utils/color.h"
+#include "math/area.h"
+#include "render/framebuffer.h"
+#include "render/encoders.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <sys/mman.h>
+
+
+// gamma + quantize rows [min_y, max_y) of a linear rgb buffer
+inline void quantize_rows(const float* rgb, int width, int min_y, int max_y, std::vector<uint8_t>& out) {
+    out.resize(size_t(width) * (max_y - min_y) * 3);
+    const float* in = rgb + size_t(min_y) * width * 3;
+    for (size_t i = 0; i < size_t(width) * (max_y - min_y); i++) {
+        color_to_bytes(color(in[i * 3], in[i * 3 + 1], in[i * 3 + 2]), &out[i * 3]);
+    }
+}
+
+// whole image in one go -- for renders that are not streamed
+inline bool write_image(const std::string& path, const float* rgb, int width, int height, image_format format) {
+    std::unique_ptr<image_encoder> encoder = make_encoder(format);
+    if (!encoder->open(path, width, height)) {
+        std::cerr << "Error: output file failed to open: " << path << std::endl;
+        return false;
+    }
+
+    // a few rows at a time keeps the byte copy small
+    std::vector<uint8_t> bytes;
+    bool ok = true;
+    for (int y = 0; y < height && ok; y += 64) {
+        int rows = std::min(64, height - y);
+        quantize_rows(rgb, width, y, y + rows, bytes);
+        ok = encoder->add_rows(bytes.data(), rows);
+    }
+    return encoder->finish() && ok;
+}
+
+
+// ----------------------------------------------------- //
+// band_tracker
+// ----------------------------------------------------- //
+// finished pixels per band of band_height rows -- workers add every tile they finish, the
+// image writer waits for each band to fill up. MAP_SHARED so forked workers count into it
+
+class band_tracker {
+private:
+    std::atomic<uint32_t>* counts;
+    int _width, _height, _band_height, _band_count;
+
+public:
+    band_tracker(int width, int height, int band_height)
+        : counts(nullptr), _width(width), _height(height), _band_height(std::max(1, band_height)),
+          _band_count((height + std::max(1, band_height) - 1) / std::max(1, band_height)) {
+
+        void* memory = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: band counter allocation failed" << std::endl;
+            return;
+        }
+        counts = static_cast<std::atomic<uint32_t>*>(memory);
+        for (int i = 0; i < _band_count; i++) {
+            new (&counts[i]) std::atomic<uint32_t>(0);
+        }
+    }
+    ~band_tracker() {
+        if (counts != nullptr) {
+            munmap(counts, bytes());
+        }
+    }
+
+    band_tracker(const band_tracker&) = delete;
+    band_tracker& operator=(const band_tracker&) = delete;
+
+    bool valid() const { return counts != nullptr; }
+
+    // every pixel of `tile` is done
+    void add(const area2d& tile) {
+        for (int band = tile.min_y / _band_height; band * _band_height < tile.max_y && band < _band_count; band++) {
+            int rows = std::min(tile.max_y, (band + 1) * _band_height) - std::max(tile.min_y, band * _band_height);
+            counts[band].fetch_add(uint32_t(rows * (tile.max_x - tile.min_x)), std::memory_order_release);
+        }
+    }
+
+    bool band_done(int band) const {
+        return counts[band].load(std::memory_order_acquire) >= uint32_t(_width * (band_end(band) - band_start(band)));
+    }
+
+    int band_count() const { return _band_count; }
+    int band_start(int band) const { return band * _band_height; }
+    int band_end(int band) const { return std::min(_height, (band + 1) * _band_height); }
+
+private:
+    size_t bytes() const { return std::max<size_t>(1, size_t(_band_count)) * sizeof(std::atomic<uint32_t>); }
+};
+
+
+// ----------------------------------------------------- //
+// bounded_queue
+// ----------------------------------------------------- //
+// push blocks while the queue is full, pop blocks while it is empty -- pop returns false once
+// the queue is closed and drained
+
+template <class T>
+class bounded_queue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+
+public:
+    explicit bounded_queue(size_t capacity) : capacity(std::max<size_t>(1, capacity)), closed(false) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if (closed) return;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+
+// ----------------------------------------------------- //
+// image_stream_writer
+// ----------------------------------------------------- //
+// encodes the image while it renders -- two threads in the parent process:
+//     watcher: waits for the next band (top to bottom) to be complete, quantizes it, queues it
+//     encoder: takes bands off the queue and feeds them to the encoder, which writes the file
+// only the bands still rendering when the last tile finishes are left to encode afterwards
+
+class image_stream_writer {
+private:
+    struct band {
+        int rows;
+        std::vector<uint8_t> bytes;
+    };
+
+    std::string path;
+    image_format format;
+    const framebuffer& fb;
+    band_tracker& bands;
+    bounded_queue<band> queue;
+
+    std::thread watcher;
+    std::thread encoder_thread;
+    std::atomic<bool> cancelled;
+    bool ok;
+
+public:
+    image_stream_writer(const std::string& path, image_format format, const framebuffer& fb, band_tracker& bands, size_t queue_capacity = 4)
+        : path(path), format(format), fb(fb), bands(bands), queue(queue_capacity), cancelled(false), ok(false) {}
+
+    ~image_stream_writer() {
+        cancel();
+    }
+
+    image_stream_writer(const image_stream_writer&) = delete;
+    image_stream_writer& operator=(const image_stream_writer&) = delete;
+
+    void start() {
+        ok = true;
+        watcher = std::thread([this]() { watch(); });
+        encoder_thread = std::thread([this]() { encode(); });
+    }
+
+    // waits for the last band -- true if the file was written completely
+    bool finish() {
+        if (watcher.joinable()) watcher.join();
+        if (encoder_thread.joinable()) encoder_thread.join();
+        return ok && !cancelled;
+    }
+
+    // the render failed -- stop waiting for bands that will never come
+    void cancel() {
+        cancelled = true;
+        queue.close();
+        finish();
+    }
+
+private:
+    void watch() {
+        for (int b = 0; b < bands.band_count() && !cancelled; b++) {
+            while (!bands.band_done(b)) {
+                if (cancelled) {
+                    queue.close();
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            band next;
+            next.rows = bands.band_end(b) - bands.band_start(b);
+            quantize_rows(fb.color_data(), fb.width(), bands.band_start(b), bands.band_end(b), next.bytes);
+            queue.push(std::move(next));
+        }
+        queue.close();
+    }
+
+    void encode() {
+        std::unique_ptr<image_encoder> encoder = make_encoder(format);
+        if (!encoder->open(path, fb.width(), fb.height())) {
+            std::cerr << "Error: output file failed to open: " << path << std::endl;
+            ok = false;
+        }
+
+        band next;
+        while (queue.pop(next)) {
+            ok = ok && encoder->add_rows(next.bytes.data(), next.rows);
+        }
+        ok = encoder->finish() && ok;
+    }
+};
+
+
+#endif
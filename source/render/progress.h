@@ -0,0 +1,183 @@
+
+#ifndef progress_h
+#define progress_h
+
+#include "utils/common.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <sys/mman.h>
+
+
+// ----------------------------------------------------- //
+// progress_counters
+// ----------------------------------------------------- //
+// bumped by the render workers once per finished tile / row -- relaxed atomic adds, no locks,
+// no syscalls. lives in MAP_SHARED memory so forked children count into the parent's copy
+
+struct progress_counters {
+    std::atomic<uint64_t> pixels;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> rays;         // traced -- camera, bounce + shadow rays
+
+    void add(uint64_t pixel_count, uint64_t sample_count, uint64_t ray_count = 0) {
+        pixels.fetch_add(pixel_count, std::memory_order_relaxed);
+        samples.fetch_add(sample_count, std::memory_order_relaxed);
+        rays.fetch_add(ray_count, std::memory_order_relaxed);
+    }
+};
+
+
+// ----------------------------------------------------- //
+// progress_reporter
+// ----------------------------------------------------- //
+// one low frequency thread in the parent -- prints percent complete, samples / sec and eta,
+// and optionally rewrites a small json status file a job scheduler can poll
+
+class progress_reporter {
+private:
+    progress_counters* _counters;
+    uint64_t _total_pixels;
+    uint64_t _total_samples;
+    std::string _status_path;
+    int _interval_ms;
+
+    std::chrono::steady_clock::time_point _start_time;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping;
+
+public:
+    progress_reporter(uint64_t total_pixels, int samples_per_pixel, const std::string& status_path = "", int interval_ms = 500)
+        : _counters(nullptr), _total_pixels(total_pixels), _total_samples(total_pixels * uint64_t(samples_per_pixel)),
+          _status_path(status_path), _interval_ms(std::max(1, interval_ms)), _stopping(false) {
+
+        void* memory = mmap(nullptr, sizeof(progress_counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Error: progress counter allocation failed" << std::endl;
+            return;
+        }
+
+        _counters = new (memory) progress_counters();
+        _counters->pixels.store(0);
+        _counters->samples.store(0);
+        _counters->rays.store(0);
+        if (!_counters->pixels.is_lock_free()) {
+            // a lock based atomic would not be shared correctly across processes
+            std::cerr << "Warning: 64 bit atomics are not lock free -- progress may be wrong across processes" << std::endl;
+        }
+    }
+
+    ~progress_reporter() {
+        stop();
+        if (_counters != nullptr) {
+            _counters->~progress_counters();
+            munmap(_counters, sizeof(progress_counters));
+        }
+    }
+
+    progress_reporter(const progress_reporter&) = delete;
+    progress_reporter& operator=(const progress_reporter&) = delete;
+
+    // null if the shared allocation failed -- callers skip counting
+    progress_counters* counters() { return _counters; }
+
+    void start() {
+        _start_time = std::chrono::steady_clock::now();
+        _stopping = false;
+        write_status("rendering");
+        _thread = std::thread([this]() { run(); });
+    }
+
+    // prints the final line + marks the status file done
+    void stop() {
+        if (!_thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+
+        report();
+        std::clog << std::endl;
+        write_status("done");
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_wake.wait_for(lock, std::chrono::milliseconds(_interval_ms), [this]() { return _stopping; })) {
+            report();
+            write_status("rendering");
+        }
+    }
+
+    double elapsed_seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start_time).count();
+    }
+
+    void report() const {
+        if (_counters == nullptr) {
+            return;
+        }
+
+        uint64_t samples = _counters->samples.load(std::memory_order_relaxed);
+        double elapsed = elapsed_seconds();
+        double percent = _total_samples > 0 ? 100.0 * samples / _total_samples : 100.0;
+        double rate = elapsed > 0 ? samples / elapsed : 0;
+        double eta = rate > 0 ? (_total_samples - std::min(samples, _total_samples)) / rate : 0;
+
+        char line[128];
+        snprintf(line, sizeof(line), "\rProgress: %5.1f%% | %.2f M samples/s | ETA %ds    ",
+                 percent, rate * 1e-6, int(eta + 0.5));
+        std::clog << line << std::flush;
+    }
+
+    void write_status(const char* state) const {
+        if (_status_path.empty() || _counters == nullptr) {
+            return;
+        }
+
+        uint64_t pixels = _counters->pixels.load(std::memory_order_relaxed);
+        uint64_t samples = _counters->samples.load(std::memory_order_relaxed);
+        double elapsed = elapsed_seconds();
+        double rate = elapsed > 0 ? samples / elapsed : 0;
+        double eta = rate > 0 ? (_total_samples - std::min(samples, _total_samples)) / rate : 0;
+
+        // write a temp file + rename -- a poller never sees a half written file
+        std::string temp_path = _status_path + ".tmp";
+        {
+            std::ofstream file(temp_path);
+            if (!file) {
+                return;
+            }
+            file << "{\"state\": \"" << state << "\""
+                 << ", \"pixels_done\": " << pixels
+                 << ", \"pixels_total\": " << _total_pixels
+                 << ", \"samples_done\": " << samples
+                 << ", \"samples_total\": " << _total_samples
+                 << ", \"percent\": " << (_total_samples > 0 ? 100.0 * samples / _total_samples : 100.0)
+                 << ", \"samples_per_second\": " << rate
+                 << ", \"elapsed_seconds\": " << elapsed
+                 << ", \"eta_seconds\": " << eta
+                 << "}" << std::endl;
+        }
+        std::rename(temp_path.c_str(), _status_path.c_str());
+    }
+};
+
+
+#endif
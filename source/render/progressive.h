@@ -0,0 +1,74 @@
+
+#ifndef progressive_h
+#define progressive_h
+
+#include "utils/common.h"
+#include "render/framebuffer.h"
+
+
+// ----------------------------------------------------- //
+// render_pass
+// ----------------------------------------------------- //
+// which pixels a pass renders + which of their samples
+// a plain render is one pass over every pixel with all samples. the progressive preview first
+// renders one pixel per block_size x block_size block (8, 4, 2, then 1) -- each level only adds
+// the pixels the coarser levels skipped, so after the 1x1 level every pixel has exactly one
+// sample -- then adds samples to every pixel until samples_per_pixel is reached
+
+struct render_pass {
+    int block_size;         // renders pixels with x, y multiples of block_size
+    int skip_block;         // ... except multiples of skip_block (done by a coarser level), 0 = none
+    int first_sample;       // sample index to start at -- the pixel already holds this many
+    int sample_count;
+
+    static render_pass full(int samples_per_pixel) {
+        return {1, 0, 0, samples_per_pixel};
+    }
+
+    bool includes(int x, int y) const {
+        if (x % block_size != 0 || y % block_size != 0) {
+            return false;
+        }
+        return skip_block == 0 || x % skip_block != 0 || y % skip_block != 0;
+    }
+};
+
+inline std::vector<render_pass> progressive_schedule(int samples_per_pixel, int coarsest_block = 8) {
+    std::vector<render_pass> passes;
+
+    // one sample per pixel, coarse to fine
+    int block = 1;
+    while (block * 2 <= coarsest_block) block *= 2;
+    for (int level = block; level >= 1; level /= 2) {
+        passes.push_back({level, level == block ? 0 : level * 2, 0, 1});
+    }
+
+    // then double the sample count every pass -- the number of passes stays logarithmic
+    int samples = 1;
+    while (samples < samples_per_pixel) {
+        int count = std::min(samples, samples_per_pixel - samples);
+        passes.push_back({1, 0, samples, count});
+        samples += count;
+    }
+    return passes;
+}
+
+// fills every pixel that has no sample yet with the pixel rendered for its block
+inline void fill_blocks(framebuffer& fb, int block_size) {
+    if (block_size <= 1) {
+        return;
+    }
+
+    for (int y = 0; y < fb.height(); y++) {
+        for (int x = 0; x < fb.width(); x++) {
+            int from_x = x - x % block_size;
+            int from_y = y - y % block_size;
+            if (from_x != x || from_y != y) {
+                fb.copy_pixel(from_x, from_y, x, y);
+            }
+        }
+    }
+}
+
+
+#endif
@@ -0,0 +1,99 @@
+
+#ifndef ray_sort_h
+#define ray_sort_h
+
+#include "utils/common.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// ----------------------------------------------------- //
+// ray sort keys
+// ----------------------------------------------------- //
+// after the first bounce rays point everywhere -- tracing them in pixel order jumps all over the
+// bvh. sorting a batch by (direction octant, morton code of the origin) puts rays that start close
+// together + head the same way next to each other, so they walk the same nodes while they are hot
+//     bits 27..29 : sign of x, y, z of the direction
+//     bits  0..26 : origin quantized to 512^3 inside the batch's bounds, z order
+
+const int ray_sort_axis_bits = 9;
+
+inline uint32_t spread_bits_3d(uint32_t x) {
+    // 10 bits -> every third bit of 30 (inverse of compact_bits, for 3 axes)
+    x &= 0x000003ffU;
+    x = (x | (x << 16)) & 0x030000ffU;
+    x = (x | (x << 8))  & 0x0300f00fU;
+    x = (x | (x << 4))  & 0x030c30c3U;
+    x = (x | (x << 2))  & 0x09249249U;
+    return x;
+}
+
+struct ray_sort_bounds {
+    point3 low;
+    vec3 scale;         // origin -> [0, 2^ray_sort_axis_bits) per axis
+
+    static ray_sort_bounds of(const point3& low, const point3& high) {
+        const double cells = double(1 << ray_sort_axis_bits);
+        ray_sort_bounds bounds;
+        bounds.low = low;
+        for (int axis = 0; axis < 3; axis++) {
+            double extent = high[axis] - low[axis];
+            bounds.scale[axis] = extent > 0 ? (cells - 1) / extent : 0;
+        }
+        return bounds;
+    }
+};
+
+inline uint32_t ray_sort_key(const point3& origin, const vec3& direction, const ray_sort_bounds& bounds) {
+    uint32_t octant = (direction.x() < 0 ? 1U : 0U) | (direction.y() < 0 ? 2U : 0U) | (direction.z() < 0 ? 4U : 0U);
+
+    uint32_t morton = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        double cell = (origin[axis] - bounds.low[axis]) * bounds.scale[axis];
+        uint32_t q = cell > 0 ? uint32_t(cell) : 0;
+        q = std::min(q, (1U << ray_sort_axis_bits) - 1);
+        morton |= spread_bits_3d(q) << axis;
+    }
+    return (octant << (3 * ray_sort_axis_bits)) | morton;
+}
+
+
+// ----------------------------------------------------- //
+// sort_ray_keys
+// ----------------------------------------------------- //
+// lsd radix sort on (key, index) -- 4 passes of 8 bits, stable, linear in the batch size.
+// passes where every key has the same digit are skipped (common for the octant byte)
+
+struct ray_sort_entry {
+    uint32_t key;
+    uint32_t index;
+};
+
+inline void sort_ray_keys(std::vector<ray_sort_entry>& entries, std::vector<ray_sort_entry>& scratch) {
+    scratch.resize(entries.size());
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t counts[257] = {0};
+        for (const ray_sort_entry& entry : entries) {
+            counts[((entry.key >> shift) & 0xff) + 1]++;
+        }
+
+        bool single_digit = false;
+        for (int digit = 1; digit <= 256; digit++) {
+            if (counts[digit] == entries.size()) single_digit = true;
+            counts[digit] += counts[digit - 1];
+        }
+        if (single_digit) {
+            continue;
+        }
+
+        for (const ray_sort_entry& entry : entries) {
+            scratch[counts[(entry.key >> shift) & 0xff]++] = entry;
+        }
+        entries.swap(scratch);
+    }
+}
+
+
+#endif
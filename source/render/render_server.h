@@ -0,0 +1,436 @@
+
+#ifndef render_server_h
+#define render_server_h
+
+#include "utils/common.h"
+#include "physics/camera.h"
+#include "physics/hittable_list.h"
+#include "render/distributed.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+
+
+// ----------------------------------------------------- //
+// render_server
+// ----------------------------------------------------- //
+// keeps one finalized scene (+ its closed world copy) in memory and renders jobs against it
+// jobs are one line of text each, from stdin or from clients of a unix / tcp socket:
+//
+//     render output=assets/thumb.ppm width=320 spp=16 lookfrom=13,2,3 lookat=0,0,0 vfov=20
+//     quit
+//
+// any camera setting left out keeps the value of the camera the server was started with
+// (keys: width aspect spp depth vfov lookfrom lookat vup defocus focus region=x0,x1,y0,y1 output id)
+// every job is cut into tiles that go into one queue shared by a fixed pool of threads -- jobs
+// take turns tile by tile, so a thumbnail is not stuck behind a large frame
+// replies, one line per job:
+//
+//     ok id=3 output=assets/thumb.ppm width=320 height=180 wait_ms=2 render_ms=41
+//     error id=4 unknown key 'sp'
+
+class render_server {
+private:
+    // one reply channel -- a socket client or stdout
+    struct client {
+        int fd;
+        std::mutex write_mutex;
+
+        explicit client(int fd) : fd(fd) {}
+
+        void reply(const std::string& line) {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            std::string text = line + "\n";
+            if (fd == STDOUT_FILENO) {
+                // stdout may be a pipe or a terminal -- plain writes, no socket flags
+                ssize_t written = write(fd, text.data(), text.size());
+                (void)written;
+            } else {
+                write_all(fd, text.data(), text.size());
+            }
+        }
+    };
+
+    struct render_job {
+        int id;
+        camera cam;
+        area2d region;
+        std::string output;
+        shared_ptr<client> requester;
+        shared_ptr<framebuffer> fb;
+
+        std::vector<area2d> tiles;
+        size_t next_tile;                   // guarded by the queue mutex
+        std::atomic<size_t> tiles_left;
+
+        std::chrono::steady_clock::time_point received;
+        std::chrono::steady_clock::time_point started;
+        bool has_started;                   // guarded by the queue mutex
+    };
+
+    const hittable_list* world;
+    camera base;                            // prepared once -- jobs copy it
+    int thread_count;
+
+    std::vector<std::thread> pool;
+    std::deque<shared_ptr<render_job>> queue;     // jobs with tiles left to hand out
+    std::mutex queue_mutex;
+    std::condition_variable queue_wake;
+    std::condition_variable idle_wake;
+    bool stopping;
+    int jobs_running;                       // submitted + not finished
+    int next_id;
+
+    std::atomic<bool> quit_requested;
+
+public:
+    // `cam` holds the defaults for every job -- world must be finalized
+    render_server(const hittable_list* world, const camera& cam, int threads = 0)
+        : world(world), base(cam), thread_count(threads), stopping(false), jobs_running(0), next_id(1), quit_requested(false) {
+        if (thread_count <= 0) {
+            thread_count = std::max(1, int(std::thread::hardware_concurrency()));
+        }
+    }
+
+    ~render_server() {
+        stop();
+    }
+
+    render_server(const render_server&) = delete;
+    render_server& operator=(const render_server&) = delete;
+
+    // ----------------------------------------------------- //
+    // front ends
+    // ----------------------------------------------------- //
+
+    // reads jobs from stdin until eof or "quit", replies on stdout
+    bool serve_stdin() {
+        if (!start()) return false;
+
+        shared_ptr<client> out = make_shared<client>(STDOUT_FILENO);
+        std::string line;
+        while (!quit_requested && std::getline(std::cin, line)) {
+            handle_line(line, out);
+        }
+
+        wait_idle();
+        stop();
+        return true;
+    }
+
+    // accepts clients on a "unix:/path" or "tcp:host:port" address until a client sends "quit"
+    bool serve_socket(const std::string& address) {
+        int listen_fd = listen_on(address);
+        if (listen_fd < 0) {
+            std::cerr << "Error: cannot listen on " << address << std::endl;
+            return false;
+        }
+        if (!start()) {
+            close(listen_fd);
+            return false;
+        }
+        std::cout << "Render server: listening on " << address << " with " << thread_count << " threads" << std::endl;
+
+        std::vector<std::thread> readers;
+        while (!quit_requested) {
+            pollfd p;
+            p.fd = listen_fd;
+            p.events = POLLIN;
+            if (poll(&p, 1, 200) <= 0) continue;
+
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) continue;
+            socket_no_sigpipe(fd);
+
+            shared_ptr<client> c = make_shared<client>(fd);
+            readers.push_back(std::thread([this, c]() { read_client(c); }));
+        }
+
+        close(listen_fd);
+        if (address.compare(0, 5, "unix:") == 0) {
+            unlink(address.substr(5).c_str());
+        }
+
+        wait_idle();
+        stop();
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        return true;
+    }
+
+    // ----------------------------------------------------- //
+    // jobs
+    // ----------------------------------------------------- //
+
+    // parses + queues one request line -- errors are replied straight away
+    void handle_line(const std::string& line, const shared_ptr<client>& requester) {
+        std::istringstream tokens(line);
+        std::string command;
+        if (!(tokens >> command)) {
+            return;
+        }
+        if (command == "quit") {
+            quit_requested = true;
+            requester->reply("ok quit");
+            return;
+        }
+        if (command != "render") {
+            requester->reply("error unknown command '" + command + "'");
+            return;
+        }
+
+        shared_ptr<render_job> job = make_shared<render_job>();
+        job->cam = base;
+        job->region = {0, -1, 0, -1};
+        job->requester = requester;
+        job->received = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            job->id = next_id++;
+        }
+
+        std::string token, error;
+        while (error.empty() && tokens >> token) {
+            size_t eq = token.find('=');
+            if (eq == std::string::npos) {
+                error = "expected key=value, got '" + token + "'";
+                break;
+            }
+            error = apply_setting(*job, token.substr(0, eq), token.substr(eq + 1));
+        }
+        if (job->output.empty()) {
+            job->output = "assets/server-" + std::to_string(job->id) + ".ppm";
+        }
+
+        std::ostringstream prefix;
+        prefix << "id=" << job->id;
+        if (error.empty()) {
+            error = submit(job);
+        }
+        if (!error.empty()) {
+            requester->reply("error " + prefix.str() + " " + error);
+        }
+    }
+
+private:
+    bool start() {
+        // the scene work every job shares -- closed world compile, kernel choice
+        if (base.streamed_world != nullptr) {
+            // the cluster cache is per process state, not shared between threads
+            std::cerr << "Error: the render server does not support streamed scenes" << std::endl;
+            return false;
+        }
+        base.hit_cache_file = "";
+        base.prepare(world);
+
+        stopping = false;
+        for (int i = 0; i < thread_count; i++) {
+            pool.push_back(std::thread([this]() { work(); }));
+        }
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_wake.notify_all();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        pool.clear();
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        idle_wake.wait(lock, [this]() { return jobs_running == 0; });
+    }
+
+    void read_client(shared_ptr<client> c) {
+        // one line per request -- buffered by hand, the socket is shared with the reply writes
+        std::string pending;
+        char buffer[4096];
+        while (!quit_requested) {
+            pollfd p;
+            p.fd = c->fd;
+            p.events = POLLIN;
+            if (poll(&p, 1, 200) <= 0) continue;
+
+            ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            pending.append(buffer, size_t(n));
+
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                handle_line(pending.substr(0, newline), c);
+                pending.erase(0, newline + 1);
+            }
+        }
+
+        // replies of jobs still running go nowhere once the fd is closed -- wait for them first
+        wait_idle();
+        close(c->fd);
+    }
+
+    static bool parse_vec3(const std::string& text, vec3& out) {
+        double x, y, z;
+        char comma1, comma2;
+        std::istringstream in(text);
+        if (!(in >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') return false;
+        out = vec3(x, y, z);
+        return true;
+    }
+
+    static bool parse_number(const std::string& text, double& out) {
+        std::istringstream in(text);
+        return bool(in >> out) && in.eof();
+    }
+
+    // empty string if the setting was applied
+    static std::string apply_setting(render_job& job, const std::string& key, const std::string& value) {
+        camera& cam = job.cam;
+        double number = 0;
+        vec3 v;
+
+        if (key == "output") { job.output = value; return ""; }
+        if (key == "lookfrom" || key == "lookat" || key == "vup") {
+            if (!parse_vec3(value, v)) return "bad vector '" + value + "' -- expected x,y,z";
+            (key == "lookfrom" ? cam.lookfrom : key == "lookat" ? cam.lookat : cam.vup) = v;
+            return "";
+        }
+        if (key == "region") {
+            area2d r;
+            char c1, c2, c3;
+            std::istringstream in(value);
+            if (!(in >> r.min_x >> c1 >> r.max_x >> c2 >> r.min_y >> c3 >> r.max_y)) return "bad region '" + value + "' -- expected x0,x1,y0,y1";
+            job.region = r;
+            return "";
+        }
+
+        if (!parse_number(value, number)) return "bad number '" + value + "' for " + key;
+        if (key == "width")        cam.width = int(number);
+        else if (key == "aspect")  cam.aspect_ratio = number;
+        else if (key == "spp")     cam.samples_per_pixel = int(number);
+        else if (key == "depth")   cam.max_depth = int(number);
+        else if (key == "vfov")    cam.vfov = number;
+        else if (key == "defocus") cam.defocus_angle = number;
+        else if (key == "focus")   cam.focus_dist = number;
+        else return "unknown key '" + key + "'";
+        return "";
+    }
+
+    std::string submit(const shared_ptr<render_job>& job) {
+        camera& cam = job->cam;
+        if (cam.width < 1 || cam.samples_per_pixel < 1 || cam.aspect_ratio <= 0) {
+            return "width, spp and aspect must be positive";
+        }
+        cam.prepare_job(world);
+
+        // default region is the whole frame -- anything else is clipped to it
+        area2d& r = job->region;
+        if (r.max_x < 0) r = {0, cam.width, 0, cam.get_height()};
+        r.min_x = std::max(0, r.min_x);
+        r.min_y = std::max(0, r.min_y);
+        r.max_x = std::min(cam.width, r.max_x);
+        r.max_y = std::min(cam.get_height(), r.max_y);
+        if (r.min_x >= r.max_x || r.min_y >= r.max_y) {
+            return "empty region";
+        }
+
+        job->fb = make_shared<framebuffer>(cam.width, cam.get_height(), false);
+        if (!job->fb->valid()) {
+            return "framebuffer allocation failed";
+        }
+        job->tiles = cam.portion_tiles(r);
+        job->next_tile = 0;
+        job->tiles_left = job->tiles.size();
+        job->has_started = false;
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(job);
+            jobs_running++;
+        }
+        queue_wake.notify_all();
+        return "";
+    }
+
+    void work() {
+        while (true) {
+            shared_ptr<render_job> job;
+            area2d tile;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;         // stopping
+                }
+
+                // round robin -- take one tile of the front job, then move it to the back
+                job = queue.front();
+                queue.pop_front();
+                tile = job->tiles[job->next_tile++];
+                if (job->next_tile < job->tiles.size()) {
+                    queue.push_back(job);
+                }
+                if (!job->has_started) {
+                    job->has_started = true;
+                    job->started = std::chrono::steady_clock::now();
+                }
+            }
+
+            job->cam.render_portion(world, &tile, render_pass::full(job->cam.samples_per_pixel), nullptr, job->fb.get());
+
+            if (job->tiles_left.fetch_sub(1) == 1) {
+                finish(*job);
+            }
+        }
+    }
+
+    void finish(render_job& job) {
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        // only the region is written
+        const area2d& r = job.region;
+        int w = r.max_x - r.min_x;
+        int h = r.max_y - r.min_y;
+        std::vector<float> pixels;
+        pixels.reserve(size_t(w) * h * 3);
+        for (int y = r.min_y; y < r.max_y; y++) {
+            const float* row = job.fb->color_data() + job.fb->index(r.min_x, y) * 3;
+            pixels.insert(pixels.end(), row, row + size_t(w) * 3);
+        }
+        bool written = write_ppm(job.output, pixels.data(), w, h);
+
+        std::ostringstream reply;
+        if (written) {
+            reply << "ok id=" << job.id << " output=" << job.output << " width=" << w << " height=" << h
+                  << " wait_ms=" << std::chrono::duration_cast<std::chrono::milliseconds>(job.started - job.received).count()
+                  << " render_ms=" << std::chrono::duration_cast<std::chrono::milliseconds>(end - job.started).count();
+        } else {
+            reply << "error id=" << job.id << " cannot write " << job.output;
+        }
+        job.requester->reply(reply.str());
+        job.fb = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            jobs_running--;
+        }
+        idle_wake.notify_all();
+    }
+};
+
+
+#endif
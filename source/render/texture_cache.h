@@ -0,0 +1,434 @@
+
+#ifndef texture_cache_h
+#define texture_cache_h
+
+#include "utils/common.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// ----------------------------------------------------- //
+// tiled texture files
+// ----------------------------------------------------- //
+// an image + its whole mip chain, cut into square tiles of 8 bit rgb (gamma 2, like the output
+// images) -- a texture is never loaded as a whole, the cache reads the tiles it needs
+//     header | level table | level 0 tiles | level 1 tiles | ...
+// tiles are stored row major inside each level, edge tiles padded to the full tile size
+
+struct texture_file_header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t level_count;
+};
+
+struct texture_level {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint64_t offset;            // first tile of the level, from the start of the file
+};
+
+// reads a P3 / P6 ppm into 8 bit rgb
+inline bool read_ppm(const std::string& path, std::vector<uint8_t>& rgb, int& width, int& height) {
+    std::ifstream input(path, std::ios::binary);
+    std::string format;
+    int max_value = 0;
+    input >> format >> width >> height >> max_value;
+    if (!input || (format != "P3" && format != "P6") || width <= 0 || height <= 0 || max_value <= 0 || max_value > 255) {
+        std::cerr << "Error: not a readable 8 bit ppm: " << path << std::endl;
+        return false;
+    }
+
+    rgb.resize(size_t(width) * height * 3);
+    if (format == "P6") {
+        input.get();
+        input.read(reinterpret_cast<char*>(rgb.data()), std::streamsize(rgb.size()));
+    } else {
+        for (size_t i = 0; i < rgb.size() && input; i++) {
+            int value;
+            input >> value;
+            rgb[i] = uint8_t(value);
+        }
+    }
+    if (!input) {
+        std::cerr << "Error: ppm is truncated: " << path << std::endl;
+        return false;
+    }
+
+    if (max_value != 255) {
+        for (uint8_t& value : rgb) value = uint8_t(std::min(255, value * 255 / max_value));
+    }
+    return true;
+}
+
+
+// ----------------------------------------------------- //
+// write_texture_file
+// ----------------------------------------------------- //
+// builds the mip chain (2x2 box filter, averaged in linear space) + writes it tile by tile
+// done once per asset, offline -- the renderer only ever reads the result
+
+inline std::vector<uint8_t> downsample_level(const std::vector<uint8_t>& rgb, int width, int height, int& half_width, int& half_height) {
+    half_width = std::max(1, width / 2);
+    half_height = std::max(1, height / 2);
+
+    std::vector<uint8_t> half(size_t(half_width) * half_height * 3);
+    for (int y = 0; y < half_height; y++) {
+        for (int x = 0; x < half_width; x++) {
+            for (int c = 0; c < 3; c++) {
+                // odd sizes -- the last row / column is reused
+                double sum = 0;
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        int sx = std::min(width - 1, 2 * x + dx);
+                        int sy = std::min(height - 1, 2 * y + dy);
+                        double value = rgb[(size_t(sy) * width + sx) * 3 + c] / 255.0;
+                        sum += value * value;
+                    }
+                }
+                half[(size_t(y) * half_width + x) * 3 + c] = uint8_t(std::min(255.0, std::sqrt(sum / 4) * 255.0 + 0.5));
+            }
+        }
+    }
+    return half;
+}
+
+inline bool write_texture_file(const std::string& path, const std::vector<uint8_t>& rgb, int width, int height, int tile_size = 64) {
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) {
+        std::cerr << "Error: texture file failed to open: " << path << std::endl;
+        return false;
+    }
+
+    texture_file_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "rtex1", 6);
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.tile_size = uint32_t(tile_size);
+    header.level_count = 1;
+    for (int w = width, h = height; w > 1 || h > 1; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        header.level_count++;
+    }
+
+    std::vector<texture_level> levels(header.level_count);
+    uint64_t offset = sizeof(header) + levels.size() * sizeof(texture_level);
+    for (uint32_t l = 0, w = width, h = height; l < header.level_count; l++, w = std::max(1U, w / 2), h = std::max(1U, h / 2)) {
+        levels[l].width = w;
+        levels[l].height = h;
+        levels[l].tiles_x = (w + tile_size - 1) / tile_size;
+        levels[l].tiles_y = (h + tile_size - 1) / tile_size;
+        levels[l].offset = offset;
+        offset += uint64_t(levels[l].tiles_x) * levels[l].tiles_y * tile_size * tile_size * 3;
+    }
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(levels.data()), std::streamsize(levels.size() * sizeof(texture_level)));
+
+    std::vector<uint8_t> level = rgb;
+    std::vector<uint8_t> tile(size_t(tile_size) * tile_size * 3);
+    int w = width, h = height;
+    for (uint32_t l = 0; l < header.level_count; l++) {
+        for (uint32_t ty = 0; ty < levels[l].tiles_y; ty++) {
+            for (uint32_t tx = 0; tx < levels[l].tiles_x; tx++) {
+                std::fill(tile.begin(), tile.end(), 0);
+                for (int y = 0; y < tile_size && int(ty) * tile_size + y < h; y++) {
+                    int columns = std::min(tile_size, w - int(tx) * tile_size);
+                    const uint8_t* row = &level[(size_t(ty * tile_size + y) * w + tx * tile_size) * 3];
+                    std::memcpy(&tile[size_t(y) * tile_size * 3], row, size_t(columns) * 3);
+                }
+                output.write(reinterpret_cast<const char*>(tile.data()), std::streamsize(tile.size()));
+            }
+        }
+
+        if (l + 1 < header.level_count) {
+            int half_width, half_height;
+            level = downsample_level(level, w, h, half_width, half_height);
+            w = half_width;
+            h = half_height;
+        }
+    }
+
+    return bool(output);
+}
+
+inline bool convert_ppm_texture(const std::string& ppm_path, const std::string& texture_path, int tile_size = 64) {
+    std::vector<uint8_t> rgb;
+    int width, height;
+    return read_ppm(ppm_path, rgb, width, height) && write_texture_file(texture_path, rgb, width, height, tile_size);
+}
+
+
+// ----------------------------------------------------- //
+// texture_file
+// ----------------------------------------------------- //
+// an open tiled texture -- only the header + level table are kept in memory, tiles are read
+// with pread (safe from any thread, no shared file position)
+
+class texture_file {
+private:
+    int fd;
+    uint32_t _id;
+    texture_file_header header;
+    std::vector<texture_level> levels;
+
+public:
+    explicit texture_file(const std::string& path) : fd(-1), _id(next_id()) {
+        std::memset(&header, 0, sizeof(header));
+
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: texture file failed to open: " << path << std::endl;
+            return;
+        }
+
+        if (pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) || std::memcmp(header.magic, "rtex1", 6) != 0
+            || header.level_count == 0 || header.level_count > 32 || header.tile_size == 0) {
+            std::cerr << "Error: not a texture file: " << path << std::endl;
+            close_file();
+            return;
+        }
+
+        levels.resize(header.level_count);
+        ssize_t table_bytes = ssize_t(levels.size() * sizeof(texture_level));
+        if (pread(fd, levels.data(), size_t(table_bytes), sizeof(header)) != table_bytes) {
+            std::cerr << "Error: texture file is truncated: " << path << std::endl;
+            close_file();
+        }
+    }
+
+    ~texture_file() {
+        close_file();
+    }
+
+    texture_file(const texture_file&) = delete;
+    texture_file& operator=(const texture_file&) = delete;
+
+    bool valid() const { return fd >= 0; }
+
+    // unique per process -- part of the cache key
+    uint32_t id() const { return _id; }
+
+    int tile_size() const { return int(header.tile_size); }
+    int level_count() const { return int(levels.size()); }
+    const texture_level& level(int l) const { return levels[l]; }
+
+    size_t tile_bytes() const { return size_t(header.tile_size) * header.tile_size * 3; }
+
+    bool read_tile(int l, int tx, int ty, uint8_t* out) const {
+        const texture_level& lv = levels[l];
+        off_t offset = off_t(lv.offset + (uint64_t(ty) * lv.tiles_x + tx) * tile_bytes());
+        return pread(fd, out, tile_bytes(), offset) == ssize_t(tile_bytes());
+    }
+
+private:
+    static uint32_t next_id() {
+        static std::atomic<uint32_t> counter(0);
+        return counter.fetch_add(1);
+    }
+
+    void close_file() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+};
+
+
+// ----------------------------------------------------- //
+// texture_cache
+// ----------------------------------------------------- //
+// tiles of every open texture file, least recently used first out once the byte budget is full
+// the budget is split over shards with a lock each, so threads looking up different tiles
+// rarely wait on each other. tiles are handed out as shared_ptr -- an evicted tile stays alive
+// until its last reader lets go of it
+// each thread also remembers its last few tiles (no lock at all), which is where most texel
+// fetches of a bilinear / trilinear lookup end up
+// forked workers each have their own copy, so the budget holds per process
+
+typedef std::vector<uint8_t> texture_tile;
+
+struct texture_cache_statistics {
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
+class texture_cache {
+private:
+    static const int shard_count = 16;
+    static const int recent_count = 8;
+
+    struct shard {
+        typedef std::pair<uint64_t, shared_ptr<const texture_tile>> entry;
+
+        std::mutex mutex;
+        std::list<entry> order;                                             // most recently used first
+        std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+        size_t bytes = 0;
+        uint64_t misses = 0, evictions = 0;                                 // counted locally, flushed in batches
+    };
+
+    struct recent_tiles {
+        uint64_t keys[recent_count];
+        shared_ptr<const texture_tile> tiles[recent_count];
+        const texture_cache* owner = nullptr;
+        uint64_t lookups = 0;
+    };
+
+    shard shards[shard_count];
+    std::atomic<size_t> shard_budget;
+    texture_cache_statistics* statistics;       // MAP_SHARED -- totals over every process
+
+public:
+    explicit texture_cache(size_t budget_bytes) : shard_budget(budget_bytes / shard_count), statistics(nullptr) {
+        void* shared = mmap(nullptr, sizeof(texture_cache_statistics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared != MAP_FAILED) {
+            statistics = new (shared) texture_cache_statistics();
+            statistics->lookups.store(0);
+            statistics->misses.store(0);
+            statistics->evictions.store(0);
+        }
+    }
+
+    ~texture_cache() {
+        if (statistics != nullptr) munmap(statistics, sizeof(texture_cache_statistics));
+    }
+
+    texture_cache(const texture_cache&) = delete;
+    texture_cache& operator=(const texture_cache&) = delete;
+
+    // takes effect on the next insert -- set before rendering
+    void set_budget(size_t budget_bytes) {
+        shard_budget = budget_bytes / shard_count;
+    }
+
+    size_t budget() const { return shard_budget * shard_count; }
+
+    // tile (tx, ty) of level l, read from the file on a miss -- null if the read failed
+    shared_ptr<const texture_tile> tile(const texture_file& file, int l, int tx, int ty) {
+        uint64_t key = (uint64_t(file.id()) << 48) | (uint64_t(l) << 40) | (uint64_t(ty) << 20) | uint64_t(tx);
+
+        recent_tiles& recent = thread_recent();
+        if (++recent.lookups >= (1U << 16) && statistics != nullptr) {
+            statistics->lookups.fetch_add(recent.lookups, std::memory_order_relaxed);
+            recent.lookups = 0;
+        }
+        int slot = int(key % recent_count);
+        if (recent.tiles[slot] != nullptr && recent.keys[slot] == key) {
+            return recent.tiles[slot];
+        }
+
+        shared_ptr<const texture_tile> result = find_or_load(file, l, tx, ty, key);
+        recent.keys[slot] = key;
+        recent.tiles[slot] = result;
+        return result;
+    }
+
+    // ----------------------------------------------------- //
+    // statistics
+    // ----------------------------------------------------- //
+
+    // adds this process' counts to the shared totals -- call when a worker is done (lookups are
+    // counted per thread, the calling thread's are added here, other threads' every 65536)
+    void flush_statistics() {
+        if (statistics == nullptr) return;
+
+        recent_tiles& recent = thread_recent();
+        statistics->lookups.fetch_add(recent.lookups, std::memory_order_relaxed);
+        recent.lookups = 0;
+
+        for (shard& s : shards) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            statistics->misses.fetch_add(s.misses, std::memory_order_relaxed);
+            statistics->evictions.fetch_add(s.evictions, std::memory_order_relaxed);
+            s.misses = s.evictions = 0;
+        }
+    }
+
+    // prints nothing if no texture was sampled
+    void print_statistics(std::ostream& out) const {
+        if (statistics == nullptr || statistics->lookups.load() == 0) return;
+
+        uint64_t lookups = statistics->lookups.load();
+        uint64_t misses = statistics->misses.load();
+        double hit_rate = 100.0 * (lookups - std::min(lookups, misses)) / lookups;
+        out << "Texture cache: " << lookups << " tile lookups, " << hit_rate << "% hits, " << misses << " tile reads, "
+            << statistics->evictions.load() << " evictions (" << budget() / (1024 * 1024) << " MB budget per process)" << std::endl;
+    }
+
+private:
+    recent_tiles& thread_recent() {
+        // one set per thread -- dropped if the thread last used a different cache
+        static thread_local recent_tiles recent;
+        if (recent.owner != this) {
+            for (shared_ptr<const texture_tile>& t : recent.tiles) t.reset();
+            recent.owner = this;
+        }
+        return recent;
+    }
+
+    shared_ptr<const texture_tile> find_or_load(const texture_file& file, int l, int tx, int ty, uint64_t key) {
+        shard& s = shards[(key ^ (key >> 20) ^ (key >> 40)) % shard_count];
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto found = s.index.find(key);
+            if (found != s.index.end()) {
+                s.order.splice(s.order.begin(), s.order, found->second);
+                return found->second->second;
+            }
+        }
+
+        // read outside the lock -- two threads missing on the same tile both read it, the
+        // second insert is dropped
+        shared_ptr<texture_tile> loaded = make_shared<texture_tile>(file.tile_bytes());
+        if (!file.read_tile(l, tx, ty, loaded->data())) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto found = s.index.find(key);
+        if (found != s.index.end()) {
+            return found->second->second;
+        }
+
+        s.misses++;
+        s.order.emplace_front(key, loaded);
+        s.index[key] = s.order.begin();
+        s.bytes += loaded->size();
+
+        // always keeps the tile just read, even if it alone is over the budget
+        size_t limit = shard_budget;
+        while (s.bytes > limit && s.order.size() > 1) {
+            s.bytes -= s.order.back().second->size();
+            s.index.erase(s.order.back().first);
+            s.order.pop_back();
+            s.evictions++;
+        }
+        return loaded;
+    }
+};
+
+// every image_texture reads through this one -- the camera sets its budget (texture_cache_mb)
+inline texture_cache& shared_texture_cache() {
+    static texture_cache cache(size_t(256) * 1024 * 1024);
+    return cache;
+}
+
+
+#endif
@@ -0,0 +1,177 @@
+
+#ifndef topology_h
+#define topology_h
+
+#include "utils/common.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+// ----------------------------------------------------- //
+// cpu_topology
+// ----------------------------------------------------- //
+// logical cpus with their core, socket (package) and numa node, read from
+// /sys/devices/system/cpu + /sys/devices/system/node
+// anywhere that information is missing (not linux, containers without /sys) every cpu is its
+// own core on package 0 / node 0
+
+struct logical_cpu {
+    int cpu;            // id used by sched_setaffinity
+    int core;           // core_id -- only unique within a package
+    int package;        // physical_package_id (socket)
+    int node;           // numa node
+    int thread;         // 0 for the first hyperthread of a core, 1 for its sibling ...
+};
+
+class cpu_topology {
+public:
+    std::vector<logical_cpu> cpus;
+    int node_count = 1;
+    int package_count = 1;
+    int core_count = 0;
+
+    static cpu_topology discover() {
+        cpu_topology topology;
+
+        std::vector<int> online = parse_cpu_list(read_line("/sys/devices/system/cpu/online"));
+        if (online.empty()) {
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            for (int i = 0; i < std::max(1L, count); i++) online.push_back(i);
+        }
+
+        // numa nodes list their cpus -- a cpu in no node list stays on node 0
+        std::map<int, int> node_of;
+        for (int node : parse_cpu_list(read_line("/sys/devices/system/node/online"))) {
+            std::ostringstream path;
+            path << "/sys/devices/system/node/node" << node << "/cpulist";
+            for (int cpu : parse_cpu_list(read_line(path.str()))) {
+                node_of[cpu] = node;
+            }
+            topology.node_count = std::max(topology.node_count, node + 1);
+        }
+
+        std::map<std::pair<int, int>, int> threads_per_core;
+        for (int cpu : online) {
+            std::ostringstream base;
+            base << "/sys/devices/system/cpu/cpu" << cpu << "/topology/";
+
+            logical_cpu c;
+            c.cpu = cpu;
+            c.core = read_int(base.str() + "core_id", cpu);
+            c.package = read_int(base.str() + "physical_package_id", 0);
+            c.node = node_of.count(cpu) ? node_of[cpu] : 0;
+            c.thread = threads_per_core[std::make_pair(c.package, c.core)]++;
+            topology.cpus.push_back(c);
+
+            topology.package_count = std::max(topology.package_count, c.package + 1);
+        }
+        topology.core_count = int(threads_per_core.size());
+
+        return topology;
+    }
+
+    // the order workers are handed cpus in -- one thread per physical core first (hyperthread
+    // siblings last), round robin across nodes so every socket gets work early
+    std::vector<logical_cpu> worker_order() const {
+        std::vector<logical_cpu> sorted = cpus;
+        std::sort(sorted.begin(), sorted.end(), [](const logical_cpu& a, const logical_cpu& b) {
+            return a.thread != b.thread ? a.thread < b.thread : a.cpu < b.cpu;
+        });
+
+        // (thread, rank within its node, node) -- the i-th core of every node before any (i+1)-th
+        std::map<std::pair<int, int>, int> next_rank;
+        std::vector<std::pair<std::pair<int, int>, std::pair<int, int> > > keys;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            int rank = next_rank[std::make_pair(sorted[i].thread, sorted[i].node)]++;
+            keys.push_back(std::make_pair(std::make_pair(sorted[i].thread, rank), std::make_pair(sorted[i].node, int(i))));
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<logical_cpu> order;
+        for (const auto& key : keys) {
+            order.push_back(sorted[key.second.second]);
+        }
+        return order;
+    }
+
+    std::vector<int> node_cpus(int node) const {
+        std::vector<int> result;
+        for (const logical_cpu& c : cpus) {
+            if (c.node == node) result.push_back(c.cpu);
+        }
+        return result;
+    }
+
+    void print(std::ostream& out) const {
+        out << "Topology: " << cpus.size() << " cpus, " << core_count << " cores, "
+            << package_count << " packages, " << node_count << " numa nodes" << std::endl;
+    }
+
+    // "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> result;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty()) continue;
+
+            size_t dash = range.find('-');
+            int first = std::atoi(range.substr(0, dash).c_str());
+            int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+            for (int i = first; i <= last; i++) result.push_back(i);
+        }
+        return result;
+    }
+
+private:
+    static std::string read_line(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    static int read_int(const std::string& path, int fallback) {
+        std::string line = read_line(path);
+        return line.empty() ? fallback : std::atoi(line.c_str());
+    }
+};
+
+
+// ----------------------------------------------------- //
+// pinning
+// ----------------------------------------------------- //
+// binds the calling process to the given cpus -- false where that is not supported
+
+inline bool pinning_supported() {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool pin_to_cpus(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+
+#endif
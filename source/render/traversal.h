@@ -0,0 +1,137 @@
+
+#ifndef traversal_h
+#define traversal_h
+
+#include "utils/common.h"
+
+#include <cstdint>
+
+
+// ----------------------------------------------------- //
+// space filling curves
+// ----------------------------------------------------- //
+// index -> (x, y) on a 2^order x 2^order grid
+// consecutive indices land on neighboring cells, so consecutive camera rays hit the same bvh
+// nodes + primitives while they are still in cache
+
+inline uint32_t compact_bits(uint32_t x) {
+    // keeps every other bit -- inverse of interleaving with zeros
+    x &= 0x55555555U;
+    x = (x ^ (x >> 1)) & 0x33333333U;
+    x = (x ^ (x >> 2)) & 0x0f0f0f0fU;
+    x = (x ^ (x >> 4)) & 0x00ff00ffU;
+    x = (x ^ (x >> 8)) & 0x0000ffffU;
+    return x;
+}
+
+inline void morton_to_xy(uint32_t index, int& x, int& y) {
+    // z order -- x in the even bits, y in the odd bits
+    x = int(compact_bits(index));
+    y = int(compact_bits(index >> 1));
+}
+
+inline void hilbert_to_xy(int order, uint32_t index, int& x, int& y) {
+    // every step is to an edge neighbor (no jumps like morton has between quadrants)
+    x = 0;
+    y = 0;
+    for (int s = 1; s < (1 << order); s <<= 1) {
+        int rx = 1 & int(index >> 1);
+        int ry = 1 & int(index ^ uint32_t(rx));
+
+        // rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+
+        x += s * rx;
+        y += s * ry;
+        index >>= 2;
+    }
+}
+
+
+// ----------------------------------------------------- //
+// pixel traversal
+// ----------------------------------------------------- //
+
+enum class pixel_order {
+    scanline,       // row by row across the whole portion -- the original behavior
+    morton,         // tiles + pixels inside each tile along a z order curve
+    hilbert         // tiles + pixels inside each tile along a hilbert curve
+};
+
+inline const char* pixel_order_name(pixel_order order) {
+    switch (order) {
+        case pixel_order::morton:  return "morton";
+        case pixel_order::hilbert: return "hilbert";
+        default:                   return "scanline";
+    }
+}
+
+struct pixel_coord {
+    int x;
+    int y;
+};
+
+inline int curve_order(int size) {
+    // smallest n with 2^n >= size
+    int order = 0;
+    while ((1 << order) < size) order++;
+    return order;
+}
+
+// the cells of a width x height grid in curve order -- the curve covers the next power of two
+// square, cells outside the grid are skipped
+inline std::vector<pixel_coord> curve_cells(int width, int height, pixel_order order) {
+    std::vector<pixel_coord> cells;
+    cells.reserve(size_t(width) * height);
+
+    if (order == pixel_order::scanline) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                cells.push_back({x, y});
+            }
+        }
+        return cells;
+    }
+
+    int n = curve_order(std::max(width, height));
+    uint32_t count = uint32_t(1) << (2 * n);
+    for (uint32_t i = 0; i < count; i++) {
+        int x, y;
+        if (order == pixel_order::morton) {
+            morton_to_xy(i, x, y);
+        } else {
+            hilbert_to_xy(n, i, x, y);
+        }
+
+        if (x < width && y < height) {
+            cells.push_back({x, y});
+        }
+    }
+    return cells;
+}
+
+// splits `portion` into tile_size x tile_size tiles (clipped at the edges), in curve order
+inline std::vector<area2d> tile_portion(const area2d& portion, int tile_size, pixel_order order) {
+    tile_size = std::max(1, tile_size);
+    int tiles_x = (portion.max_x - portion.min_x + tile_size - 1) / tile_size;
+    int tiles_y = (portion.max_y - portion.min_y + tile_size - 1) / tile_size;
+
+    std::vector<area2d> tiles;
+    tiles.reserve(size_t(tiles_x) * tiles_y);
+    for (const pixel_coord& cell : curve_cells(tiles_x, tiles_y, order)) {
+        int min_x = portion.min_x + cell.x * tile_size;
+        int min_y = portion.min_y + cell.y * tile_size;
+        tiles.push_back({min_x, std::min(min_x + tile_size, portion.max_x),
+                         min_y, std::min(min_y + tile_size, portion.max_y)});
+    }
+    return tiles;
+}
+
+
+#endif
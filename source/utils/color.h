@@ -5,6 +5,8 @@
 
 #include "utils/common.h"
 
+#include <cstdint>
+
 #include "math/interval.h"
 #include "math/vec3.h"
 
@@ -17,25 +19,27 @@ inline double linear_to_gamma(double linear_component) {
     return 0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Apply linear to gamma transform for gamma 2
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
 
+// gamma 2 + quantization of one linear color -- every image format writes these bytes
+inline void color_to_bytes(const color& pixel_color, uint8_t bytes[3]) {
     // translate [0, 1], component to byte range [0, 255]
     static const interval intensity(0.000, 0.999);
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    for (int i = 0; i < 3; i++) {
+        bytes[i] = uint8_t(int(256 * intensity.clamp(linear_to_gamma(pixel_color[i]))));
+    }
+}
+
+void write_color(std::ostream& out, const color& pixel_color) {
+    // Apply linear to gamma transform for gamma 2
+    uint8_t bytes[3];
+    color_to_bytes(pixel_color, bytes);
 
     // write out components
 
-    out << rbyte << ' ' << gbyte << ' ' << bbyte << std::endl;
+    out << int(bytes[0]) << ' ' << int(bytes[1]) << ' ' << int(bytes[2]) << std::endl;
 }
 
 #endif
\ No newline at end of file
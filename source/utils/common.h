@@ -1,6 +1,7 @@
 #ifndef common_h
 #define common_h
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <cstdlib>
@@ -2,10 +2,22 @@
 #ifndef utils_h
 #define utils_h
 
+#include <cstddef>
+#include <cstdint>
+
 
 struct pipe_file_directory {
     int read;
     int write;
 };
 
+// fnv-1a -- chain calls to hash several fields, start with the default seed
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
 #endif
\ No newline at end of file